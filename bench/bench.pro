@@ -0,0 +1,39 @@
+######################################################################
+# Benchmarks, run all with ./bench or some with ./bench <name>...
+# --json=<path> writes the results of "utils" as JSON too
+######################################################################
+
+QT -= gui
+QT += core
+CONFIG -= debug release debug_and_release
+CONFIG += release
+CONFIG += console
+QMAKE_CXXFLAGS_WARN_ON = -Wall -Wextra
+QMAKE_CXXFLAGS += -std=c++0x
+LIBS += -lpthread
+TEMPLATE = app
+TARGET = bench
+DEPENDPATH += . ../danadam
+INCLUDEPATH += . ../danadam
+
+# Input
+HEADERS += benchmarks.h \
+           ../danadam/dabench.h \
+           ../danadam/ElapsedTimer.h \
+           ../danadam/hex.h \
+           ../danadam/latencyhistogram.h \
+           ../danadam/loggercommon.h \
+           ../danadam/loggeroutput.h \
+           ../danadam/loggerf.h \
+           ../danadam/loggerqt.h \
+           ../danadam/metrics.h \
+           ../danadam/stacktrace.h \
+           ../danadam/symbolizer.h \
+
+SOURCES += main.cpp \
+           bench_datetime.cpp \
+           bench_elapsedtimer.cpp \
+           bench_latencyhistogram.cpp \
+           bench_logf.cpp \
+           bench_loggerqt.cpp \
+           bench_utils.cpp \
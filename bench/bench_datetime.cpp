@@ -0,0 +1,55 @@
+#include "benchmarks.h"
+#include "loggercommon.h"
+
+#include <string.h>
+
+namespace
+{
+
+// da::datetimeString() as it was before the per-thread cache
+da::DateTimeString datetimeStringUncached()
+{
+    struct timeval tv;
+    struct timezone tz;
+    gettimeofday(&tv,&tz);
+
+    struct tm f;
+    time_t sec = tv.tv_sec;
+    localtime_r(&sec, &f);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d,%03d",
+            (f.tm_year + 1900), (f.tm_mon + 1), f.tm_mday,
+            f.tm_hour, f.tm_min, f.tm_sec, (int)(tv.tv_usec / 1000)
+        );
+    da::DateTimeString dt;
+    memcpy(dt.s, buf, da::DATETIME_BUF_LEN - 1);
+    dt.s[da::DATETIME_BUF_LEN - 1] = '\0';
+    return dt;
+}
+
+da::DateTimeString cached()
+{
+    return da::datetimeString();
+}
+
+} // namespace
+
+void bench_datetime(da::bench::Suite & suite)
+{
+    using da::bench::doNotOptimize;
+
+    suite.run("uncached (before)", []() { doNotOptimize(datetimeStringUncached()); });
+    da::setLogClock(da::ELogClock::precise);
+    suite.run("cached, gettimeofday", []() { doNotOptimize(cached()); });
+    da::setLogClock(da::ELogClock::coarse);
+    suite.run("cached, REALTIME_COARSE", []() { doNotOptimize(cached()); });
+    da::setLogClock(da::ELogClock::precise);
+
+    // localtime_r() takes glibc's timezone lock, so the uncached version stops scaling
+    for (int threadCount = 2; threadCount <= 16; threadCount *= 2)
+    {
+        suite.runThreaded(withThreads("uncached", threadCount), threadCount, []() { doNotOptimize(datetimeStringUncached()); });
+        suite.runThreaded(withThreads("cached", threadCount), threadCount, []() { doNotOptimize(cached()); });
+    }
+}
@@ -0,0 +1,47 @@
+#include "benchmarks.h"
+#include "loggerqt.h"
+#include "ElapsedTimer.h"
+
+#include <time.h>
+
+namespace
+{
+
+// what a TSC timer measures over a sleep, against CLOCK_MONOTONIC
+void checkAccuracy()
+{
+    ElapsedTimer timer(ElapsedTimer::tsc);
+    ElapsedTimer monotonic(ElapsedTimer::monotonic);
+    const struct timespec pause = { 0, 50 * 1000 * 1000 };
+    nanosleep(&pause, 0);
+    const uint64_t tscNs = timer.elapsed();
+    const uint64_t monotonicNs = monotonic.elapsed();
+    printf("50 ms sleep: tsc %llu ns, monotonic %llu ns\n",
+            (unsigned long long)tscNs, (unsigned long long)monotonicNs);
+}
+
+} // namespace
+
+void bench_elapsedtimer(da::bench::Suite & suite)
+{
+    using da::bench::doNotOptimize;
+
+    if (!ElapsedTimer::isTscUsable())
+        printf("no invariant TSC, the tsc rows fall back to monotonic\n");
+
+    const ElapsedTimer::EClock clocks[] = { ElapsedTimer::monotonic, ElapsedTimer::tsc };
+    const char * const clockNames[] = { "monotonic", "tsc" };
+    for (int c = 0; c < 2; c++)
+    {
+        // elapsed() is the cost of one sample, start() + elapsed() what timing a short piece of code adds to it
+        ElapsedTimer timer(clocks[c]);
+        suite.run(std::string(clockNames[c]) + " elapsed()", [&]() { doNotOptimize(timer.elapsed()); });
+        suite.run(std::string(clockNames[c]) + " start() + elapsed()", [&]() {
+            timer.start();
+            doNotOptimize(timer.elapsed());
+        });
+    }
+
+    if (ElapsedTimer::isTscUsable())
+        checkAccuracy();
+}
@@ -0,0 +1,45 @@
+#include "benchmarks.h"
+#include "latencyhistogram.h"
+
+namespace
+{
+
+// values spread over a few hundred buckets, like real latencies
+inline uint64_t fakeLatency(uint64_t i)
+{
+    return 20000 + (i * 2654435761ULL) % 200000;
+}
+
+// a different sequence in every thread
+uint64_t nextLatency()
+{
+    static thread_local uint64_t t_i = 0;
+    return fakeLatency(t_i++);
+}
+
+// each thread records into its own, as one would to merge them later
+void recordOwn()
+{
+    static thread_local da::LatencyHistogram t_own;
+    t_own.record(nextLatency());
+}
+
+} // namespace
+
+void bench_latencyhistogram(da::bench::Suite & suite)
+{
+    using da::bench::doNotOptimize;
+
+    da::LatencyHistogram histogram;
+    suite.run("record", [&]() { histogram.record(nextLatency()); });
+    suite.run("percentile", [&]() { doNotOptimize(histogram.percentile(99.9)); });
+    da::LatencyHistogram merged;
+    suite.run("merge", [&]() { merged.merge(histogram); });
+
+    for (int threadCount = 2; threadCount <= 8; threadCount *= 2)
+    {
+        da::LatencyHistogram shared;
+        suite.runThreaded(withThreads("record shared", threadCount), threadCount, [&]() { shared.record(nextLatency()); });
+        suite.runThreaded(withThreads("record own", threadCount), threadCount, recordOwn);
+    }
+}
@@ -0,0 +1,50 @@
+#include "benchmarks.h"
+#include "loggerf.h"
+
+#include <stdarg.h>
+
+namespace
+{
+
+// da::logf() as it was before the per-thread line buffer: header and message are two stdio calls
+void logfTwoPrintfs(const char * datetime, const char * level, const char * file, int line, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    printf("%s %s (%s:%d) - ", datetime, level, file, line);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+int nextArg()
+{
+    static thread_local int t_i = 0;
+    return t_i++;
+}
+
+void logTwoPrintfs()
+{
+    logfTwoPrintfs(da::datetimeString().s, "TRACE", __FILE__, __LINE__, "Message with arguments: %s - %d\n", "str", nextArg());
+}
+
+void logSingleWrite()
+{
+    TRACEF("Message with arguments: %s - %d", "str", nextArg());
+}
+
+} // namespace
+
+void bench_logf(da::bench::Suite & suite)
+{
+    // the lines go to /dev/null
+    StdoutToDevNull devNull;
+    for (int threadCount = 1; threadCount <= 16; threadCount *= 4)
+    {
+        suite.runThreaded(withThreads("2x printf", threadCount), threadCount, logTwoPrintfs);
+        fflush(stdout);
+        suite.runThreaded(withThreads("write()", threadCount), threadCount, logSingleWrite);
+        da::setLogBatching(64 * 1024, 100);
+        suite.runThreaded(withThreads("batched", threadCount), threadCount, logSingleWrite);
+        da::setLogBatching(0);
+    }
+}
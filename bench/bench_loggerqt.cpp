@@ -0,0 +1,85 @@
+#include "benchmarks.h"
+#include "loggerqt.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+namespace
+{
+
+// da::LoggerHelper as it was before streaming: one QString, toUtf8() and a global mutex
+class QStringLoggerHelper
+{
+public:
+    QStringLoggerHelper(const char * dt, da::ELogLevel::E level, const char * file, int line)
+        : m_dt(dt)
+        , m_level(level)
+        , m_file(file)
+        , m_line(line)
+    { }
+    ~QStringLoggerHelper()
+    {
+        static QMutex s_mutex;
+        const da::LogConfig & config = da::logConfig();
+        if (m_level >= config.logLevel)
+        {
+            QMutexLocker locker(&s_mutex);
+            da::logf(
+                    m_dt,
+                    config.format.logLevel ? da::ELogLevel::c_str(m_level) : 0,
+                    config.format.place ? m_file : 0,
+                    m_line,
+                    "%s\n",
+                    m_msg.toUtf8().data()
+                );
+        }
+    }
+    void operator<<(const QString & msg) { m_msg = msg; }
+
+private:
+    const char * m_dt;
+    const da::ELogLevel::E m_level;
+    const char * m_file;
+    const int m_line;
+    QString m_msg;
+};
+
+const char s_str[] = "meaning of life";
+
+int nextArg()
+{
+    static thread_local int t_i = 0;
+    return t_i++;
+}
+
+void logQString()
+{
+    QStringLoggerHelper(da::datetimeString().s, da::ELogLevel::trace, __FILE__, __LINE__)
+            << QString("Message with arguments: %1 - %2").arg(s_str).arg(nextArg());
+}
+
+void logArg()
+{
+    TRACE("Message with arguments: %1 - %2").arg(s_str).arg(nextArg());
+}
+
+void logStreamed()
+{
+    LOG(da::ELogLevel::trace) << "Message with arguments: " << s_str << " - " << nextArg();
+}
+
+} // namespace
+
+void bench_loggerqt(da::bench::Suite & suite)
+{
+    // all messages are written (to /dev/null), the batching takes the syscalls out of the picture
+    StdoutToDevNull devNull;
+    da::setLogBatching(64 * 1024, 100);
+    for (int threadCount = 1; threadCount <= 16; threadCount *= 4)
+    {
+        suite.runThreaded(withThreads("QString (before)", threadCount), threadCount, logQString);
+        suite.runThreaded(withThreads(".arg()", threadCount), threadCount, logArg);
+        suite.runThreaded(withThreads("streamed", threadCount), threadCount, logStreamed);
+    }
+    da::setLogBatching(0);
+}
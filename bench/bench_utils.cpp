@@ -0,0 +1,169 @@
+#include "benchmarks.h"
+#include "loggerf.h"
+#include "loggerqt.h"
+#include "dabench.h"
+#include "emailvalidator.h"
+#include "hex.h"
+#include "itoa.h"
+#include "metrics.h"
+#include "stacktrace.h"
+#include "stringenum.h"
+#include "stringutils.h"
+#include "symbolizer.h"
+
+#include <string>
+#include <vector>
+
+namespace
+{
+
+DEFINE_STRING_ENUM(BenchEnum, alpha, bravo, charlie, delta, echo, foxtrot, golf, hotel);
+
+typedef std::vector<std::string> StringList;
+
+// depth + 1 frames with frame pointers under captureStack(), even in this release build
+__attribute__((noinline, optimize("no-omit-frame-pointer")))
+int captureNested(int depth, void ** frames)
+{
+    const int count = depth ? captureNested(depth - 1, frames) : da::captureStack(frames, 64);
+    da::bench::doNotOptimize(count);    // no tail call
+    return count;
+}
+
+} // namespace
+
+void bench_utils(da::bench::Suite & suite)
+{
+    using da::bench::doNotOptimize;
+
+    uint8_t data[256];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 37);
+
+    const std::string csv = "alpha,bravo,charlie,delta,echo,foxtrot,golf,hotel,india,juliett,kilo,lima";
+    const StringList words = da::split<StringList>(csv, ",");
+    const std::vector<int> numbers = { 1, 22, 333, 4444, 55555, 666666, 7777777, 88888888 };
+    const std::string plain = "abc:def,ghi:jkl,mno^pqr";
+    const std::string escaped = da::escapeString(plain, ":,", '^');
+
+    {
+        // the loggers write to stdout, the validator logs too
+        StdoutToDevNull devNull;
+
+        int64_t n = 0;
+        suite.run("itoa", [&]() {
+            char buf[32];
+            doNotOptimize(da::itoa(1234567890123LL + n++, buf, sizeof(buf)));
+            doNotOptimize(buf);
+        });
+        suite.run("hexdumpLineRaw 16 B", [&]() {
+            char * hex = da::hexdumpLineRaw(data, 16);
+            doNotOptimize(hex);
+            delete[] hex;
+        });
+        suite.run("hexdumpRaw 256 B", [&]() {
+            char * hex = da::hexdumpRaw(data, sizeof(data));
+            doNotOptimize(hex);
+            delete[] hex;
+        });
+
+        // a packet hex-encoded for the trace, at the sizes the traces see
+        std::vector<uint8_t> packet(1024 * 1024);
+        for (size_t i = 0; i < packet.size(); i++)
+            packet[i] = (uint8_t)(i * 37);
+        std::vector<char> packetHex(2 * packet.size());
+        const size_t packetSizes[] = { 64, 4 * 1024, 1024 * 1024 };
+        const char * const packetSizeNames[] = { "64 B", "4 KiB", "1 MiB" };
+        for (int p = 0; p < 3; p++)
+        {
+            const size_t len = packetSizes[p];
+            suite.run(std::string("hexEncode ") + packetSizeNames[p] + " " + da::hexEncoderName(), [&]() {
+                doNotOptimize(da::hexEncode(&packetHex[0], &packet[0], len));
+            });
+            suite.run(std::string("hexEncode ") + packetSizeNames[p] + " scalar", [&]() {
+                doNotOptimize(da::detail::hexEncodeScalar(&packetHex[0], &packet[0], len));
+            });
+        }
+
+        suite.run("split 12 fields", [&]() {
+            doNotOptimize(da::split<StringList>(csv, ","));
+        });
+        suite.run("join 12 strings", [&]() {
+            doNotOptimize(da::join(words, ","));
+        });
+        suite.run("join 8 ints", [&]() {
+            doNotOptimize(da::join(numbers, ", "));
+        });
+        suite.run("escapeString", [&]() {
+            doNotOptimize(da::escapeString(plain, ":,", '^'));
+        });
+        suite.run("unescapeString", [&]() {
+            doNotOptimize(da::unescapeString(escaped, '^'));
+        });
+
+        da::setLogRules("emailvalidator.h:off");
+        suite.run("EmailValidator valid", [&]() {
+            doNotOptimize(da::EmailValidator("someone@example.com").isValid());
+        });
+        suite.run("EmailValidator invalid", [&]() {
+            doNotOptimize(da::EmailValidator("some one@exa mple.com").isValid());
+        });
+        da::setLogRules("");
+
+        suite.run("string enum fromString", [&]() {
+            BenchEnum e;
+            doNotOptimize(e.fromString("hotel"));
+            doNotOptimize(e);
+        });
+
+        suite.run("DA_COUNTER inc", [&]() {
+            DA_COUNTER("bench_total", "Benchmark counter.").inc();
+        });
+        suite.run("DA_GAUGE add", [&]() {
+            DA_GAUGE("bench_gauge", "Benchmark gauge.").add(1);
+        });
+        double value = 0;
+        suite.run("DA_HISTOGRAM observe", [&]() {
+            DA_HISTOGRAM("bench_seconds", "Benchmark histogram.", 0.001, 0.01, 0.1, 1, 10).observe(value);
+            value = value < 20 ? value + 0.01 : 0;
+        });
+
+        void * frames[64];
+        suite.run("captureStack backtrace()", [&]() {
+            doNotOptimize(captureNested(10, frames));
+        });
+        da::setStackUnwinder(da::EStackUnwinder::framePointers);
+        suite.run("captureStack frame pointers", [&]() {
+            doNotOptimize(captureNested(10, frames));
+        });
+        da::setStackUnwinder(da::EStackUnwinder::backtrace);
+
+        // this release build links without -rdynamic and captureNested() isn't even exported,
+        // its name can only come from .symtab
+        da::SymbolInfo info;
+        if (!da::symbolize((const void *)&captureNested, &info, false) || info.function.find("captureNested") == std::string::npos)
+            fprintf(stderr, "symbolize() didn't find captureNested(): \"%s\"\n", info.function.c_str());
+        suite.run("symbolize", [&]() {
+            doNotOptimize(da::symbolize(frames[0], &info));
+        });
+
+        int i = 0;
+        suite.run("TRACEF", [&]() {
+            TRACEF("Message with arguments: %s - %d", "str", i++);
+        });
+        suite.run("LOG() streamed", [&]() {
+            LOG(da::ELogLevel::trace) << "Message with arguments: " << "str" << " - " << i++;
+        });
+        suite.run("TRACE() with .arg()", [&]() {
+            TRACE("Message with arguments: %1 - %2").arg("str").arg(i++);
+        });
+        da::setLogLevel(da::ELogLevel::info);
+        suite.run("TRACEF, level off", [&]() {
+            TRACEF("Message with arguments: %s - %d", "str", i++);
+        });
+        suite.run("LOG(), level off", [&]() {
+            LOG(da::ELogLevel::trace) << "Message with arguments: " << "str" << " - " << i++;
+        });
+        da::setLogLevel(da::ELogLevel::trace);
+    }
+}
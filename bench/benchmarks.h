@@ -0,0 +1,54 @@
+#ifndef DANADAM_BENCHMARKS_H_GUARD
+#define DANADAM_BENCHMARKS_H_GUARD
+
+#include <string>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "loggerqt.h"    // TRACE for ElapsedTimer.h
+#include "dabench.h"
+
+// "<name>, <n> threads"
+inline std::string withThreads(const std::string & name, int threadCount)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), ", %d thread%s", threadCount, threadCount == 1 ? "" : "s");
+    return name + buf;
+}
+
+// sends stdout to /dev/null while in scope, so benchmarks of the loggers don't flood the terminal
+class StdoutToDevNull
+{
+public:
+    StdoutToDevNull()
+    {
+        fflush(stdout);
+        m_saved = dup(STDOUT_FILENO);
+        const int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    ~StdoutToDevNull()
+    {
+        fflush(stdout);
+        dup2(m_saved, STDOUT_FILENO);
+        close(m_saved);
+    }
+
+private:
+    StdoutToDevNull(const StdoutToDevNull &);
+    StdoutToDevNull & operator=(const StdoutToDevNull &);
+
+    int m_saved;
+};
+
+void bench_datetime(da::bench::Suite & suite);
+void bench_elapsedtimer(da::bench::Suite & suite);
+void bench_latencyhistogram(da::bench::Suite & suite);
+void bench_logf(da::bench::Suite & suite);
+void bench_loggerqt(da::bench::Suite & suite);
+void bench_utils(da::bench::Suite & suite);
+
+#endif
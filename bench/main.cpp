@@ -0,0 +1,67 @@
+#include "benchmarks.h"
+#include "loggercommon.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+INIT_LOGGER();
+
+struct Benchmark
+{
+    const char * name;
+    void (*run)(da::bench::Suite & suite);
+};
+
+static const Benchmark s_benchmarks[] = {
+    { "datetime",     bench_datetime },
+    { "elapsedtimer", bench_elapsedtimer },
+    { "histogram",    bench_latencyhistogram },
+    { "logf",         bench_logf },
+    { "loggerqt",     bench_loggerqt },
+    { "utils",        bench_utils },
+};
+
+int main(int argc, char * argv[])
+{
+    // --json=<path> writes the results of all benchmarks run there
+    const char * jsonPath = 0;
+    std::vector<const char *> names;
+    for (int j = 1; j < argc; j++)
+    {
+        if (strncmp(argv[j], "--json=", 7) == 0)
+            jsonPath = argv[j] + 7;
+        else
+            names.push_back(argv[j]);
+    }
+
+    // not in the first benchmark's warmup
+    ElapsedTimer::calibrateTsc();
+
+    da::bench::Suite all;
+    const int count = sizeof(s_benchmarks) / sizeof(s_benchmarks[0]);
+    for (int i = 0; i < count; i++)
+    {
+        bool selected = names.empty();
+        for (size_t j = 0; j < names.size(); j++)
+            selected = selected || strcmp(names[j], s_benchmarks[i].name) == 0;
+        if (!selected)
+            continue;
+
+        printf("--- %s\n", s_benchmarks[i].name);
+        da::bench::Suite suite;
+        s_benchmarks[i].run(suite);
+        suite.print();
+        for (size_t r = 0; r < suite.results().size(); r++)
+        {
+            da::bench::Result result = suite.results()[r];
+            result.name = std::string(s_benchmarks[i].name) + "/" + result.name;
+            all.add(result);
+        }
+    }
+
+    if (jsonPath && !all.writeJson(jsonPath))
+        fprintf(stderr, "can't write %s\n", jsonPath);
+}
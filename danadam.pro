@@ -9,7 +9,7 @@ CONFIG += console
 QMAKE_CXXFLAGS_WARN_ON = -Wall -Wextra
 QMAKE_CXXFLAGS_WARN_ON = -Werror    # treat warnings as errors
 QMAKE_CXXFLAGS += -std=c++0x
-QMAKE_LFLAGS += -rdynamic
+QMAKE_LFLAGS_DEBUG += -rdynamic    # only for the crash handler's frames, see crashhandler.h
 #=--------------------------------
 #LIBS += -L. -lDanadamLog
 #QMAKE_CXXFLAGS +=
@@ -25,17 +25,35 @@ INCLUDEPATH += . danadam
 
 # Input
 HEADERS += danadam/danadam.h \
+           danadam/allocprofiler.h \
            danadam/ElapsedTimer.h \
            danadam/hex.h \
            danadam/itoa.h \
+           danadam/latencyhistogram.h \
            danadam/loggercommon.h \
+           danadam/loggercallsite.h \
+           danadam/loggerconfig.h \
+           danadam/loggeroutput.h \
+           danadam/loggerfile.h \
+           danadam/loggerargs.h \
+           danadam/loggerasync.h \
+           danadam/loggerbin.h \
            danadam/loggerf.h \
+           danadam/loggerlimit.h \
            danadam/loggerqt.h \
+           danadam/metrics.h \
+           danadam/perfcounters.h \
+           danadam/profiler.h \
+           danadam/samplingprofiler.h \
            danadam/scopeguard.h \
            danadam/scopeguard_helper.h \
            danadam/stacktrace.h \
+           danadam/symbolizer.h \
+           danadam/tracer.h \
+           danadam/crashhandler.h \
            danadam/daalgorithm.h \
            danadam/dafunctional.h \
+           danadam/dabench.h \
            danadam/sfinae.h \
 
 SOURCES += main.cpp
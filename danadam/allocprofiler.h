@@ -0,0 +1,605 @@
+#ifndef DANADAM_ALLOC_PROFILER_H_GUARD
+#define DANADAM_ALLOC_PROFILER_H_GUARD
+
+/*
+ * Sampling heap profiler: which stacks allocate the most, and which of their
+ * allocations are still live.
+ *
+ * Allocations are sampled by bytes, like tcmalloc does: each thread counts
+ * down a random number of bytes, on average the sample interval (512 KiB by
+ * default), and the allocation which crosses zero is sampled. That one's
+ * stack is captured (see StackTrace in stacktrace.h, with its unwinder) and
+ * interned, and its site's totals grow by the bytes and allocations it stands
+ * for, an unbiased estimate. Other allocations cost a thread local
+ * subtraction. A sampled allocation is remembered until it is freed, so its
+ * site also shows how much of it is live; a free looks its address up in a
+ * table without taking a lock.
+ *
+ * Nothing is hooked unless exactly one source file defines one of these
+ * before including this header:
+ *
+ *  - DA_ALLOCPROFILER_DEFINE_OPERATORS - replaces the global operator new
+ *    and delete, all their forms; malloc() of C code is not seen,
+ *  - DA_ALLOCPROFILER_DEFINE_MALLOC - replaces malloc(), free() and the rest
+ *    of the family (glibc only, on top of its __libc_malloc() and friends,
+ *    in the executable, not in a shared object); this sees operator new
+ *    too, libstdc++ implements it with malloc().
+ *
+ * When profiling is off the hooks cost a relaxed load, plus a free's lookup
+ * while sampled allocations are still live.
+ *
+ * Stacks start at operator new or malloc(), or at their caller where the
+ * compiler inlined operator new. An allocation freed through a different
+ * family than it was allocated with (in the operators mode) stays live in
+ * the report.
+ *
+ * Example:
+ *
+ *      #define DA_ALLOCPROFILER_DEFINE_OPERATORS
+ *      #include "allocprofiler.h"
+ *
+ *      int main()
+ *      {
+ *          da::startAllocationProfiling();
+ *          da::printAllocationReportAtExit();
+ *          ...
+ *      }
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "stacktrace.h"
+
+#ifndef DA_ALLOC_SAMPLE_BYTES
+#  define DA_ALLOC_SAMPLE_BYTES (512 * 1024)    // the mean sample interval
+#endif
+
+#ifndef DA_ALLOC_LIVE_SIZE
+#  define DA_ALLOC_LIVE_SIZE 16384              // sampled allocations tracked until freed, power of 2
+#endif
+
+#if defined(DA_ALLOCPROFILER_DEFINE_OPERATORS) && defined(DA_ALLOCPROFILER_DEFINE_MALLOC)
+#  error "define one of DA_ALLOCPROFILER_DEFINE_OPERATORS and DA_ALLOCPROFILER_DEFINE_MALLOC"
+#endif
+
+namespace da
+{
+
+struct AllocationSite
+{
+    StackTrace stack;
+    uint64_t samples;
+    uint64_t bytes;         // estimated, allocated since startAllocationProfiling()
+    uint64_t count;
+    uint64_t liveBytes;     // estimated, not freed yet
+    uint64_t liveCount;
+};
+
+/**
+ * Starts sampling, one sample per sampleBytes allocated on average. The
+ * totals start from zero, allocations which are still live stay live.
+ */
+inline void startAllocationProfiling(size_t sampleBytes = DA_ALLOC_SAMPLE_BYTES);
+inline void stopAllocationProfiling();
+inline size_t allocationSampleBytes();
+
+// sites with samples, by bytes, or with live allocations, by live bytes
+inline std::vector<AllocationSite> allocationSites(bool live = false);
+inline std::string allocationReportString(size_t top = 10, bool live = false);
+inline void printAllocationReport(FILE * out = stderr, size_t top = 10, bool live = false);
+inline void printAllocationReportAtExit(size_t top = 10);
+
+    namespace detail
+    {
+
+    struct AllocSiteStats
+    {
+        std::atomic<uint64_t> samples;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> liveBytes;
+        std::atomic<uint64_t> liveCount;
+    };
+
+    // written before its address is published, read only while the address is there
+    struct LiveAllocation
+    {
+        uint32_t site;
+        uint64_t bytes;
+        uint64_t count;
+    };
+
+    // all constant initialized, an allocation may come before any constructor has run
+    template<typename T = void>
+    struct AllocState
+    {
+        static const uintptr_t freedSlot = 1;    // a tombstone, lookups go on past it
+        static const int maxProbes = 32;
+
+        static std::atomic<size_t> s_sampleBytes;              // 0 while off
+        static std::atomic<uint64_t> s_liveTracked;            // addresses in s_liveAddresses
+        static std::atomic<uint64_t> s_untracked;              // samples whose stack or address didn't fit
+        static std::mutex s_insertMutex;
+        static AllocSiteStats s_sites[DA_STACKTRACE_INTERN_SIZE + 1];     // by interned stack id
+        static std::atomic<uintptr_t> s_liveAddresses[DA_ALLOC_LIVE_SIZE];
+        static LiveAllocation s_liveAllocations[DA_ALLOC_LIVE_SIZE];
+    };
+
+    template<typename T>
+    std::atomic<size_t> AllocState<T>::s_sampleBytes(0);
+
+    template<typename T>
+    std::atomic<uint64_t> AllocState<T>::s_liveTracked(0);
+
+    template<typename T>
+    std::atomic<uint64_t> AllocState<T>::s_untracked(0);
+
+    template<typename T>
+    std::mutex AllocState<T>::s_insertMutex;
+
+    template<typename T>
+    AllocSiteStats AllocState<T>::s_sites[DA_STACKTRACE_INTERN_SIZE + 1];
+
+    template<typename T>
+    std::atomic<uintptr_t> AllocState<T>::s_liveAddresses[DA_ALLOC_LIVE_SIZE];
+
+    template<typename T>
+    LiveAllocation AllocState<T>::s_liveAllocations[DA_ALLOC_LIVE_SIZE];
+
+    struct AllocThreadState
+    {
+        int64_t untilSample;    // bytes
+        size_t mean;            // the sample interval untilSample was drawn for
+        uint64_t random;        // xorshift state, 0 until the thread's first allocation
+        bool inProfiler;        // allocations of the profiler itself aren't sampled
+    };
+
+    inline AllocThreadState & allocThreadState()
+    {
+        static thread_local AllocThreadState t_state = { 0, 0, 0, false };
+        return t_state;
+    }
+
+    // exponentially distributed, so samples are a Poisson process over the bytes
+    inline int64_t nextSampleInterval(AllocThreadState & t, size_t mean)
+    {
+        t.random ^= t.random << 13;
+        t.random ^= t.random >> 7;
+        t.random ^= t.random << 17;
+        const double u = ((t.random >> 11) + 0.5) / 9007199254740992.0;     // (0, 1)
+        return (int64_t)(-log(u) * mean) + 1;
+    }
+
+    inline size_t liveSlot(uintptr_t address, int probe)
+    {
+        return (size_t)(((address >> 4) * 0x9E3779B97F4A7C15ULL >> 32) + probe) & (DA_ALLOC_LIVE_SIZE - 1);
+    }
+
+    inline bool trackLive(uintptr_t address, const LiveAllocation & allocation)
+    {
+        typedef AllocState<> S;
+        std::lock_guard<std::mutex> locker(S::s_insertMutex);
+        for (int probe = 0; probe < S::maxProbes; probe++)
+        {
+            const size_t slot = liveSlot(address, probe);
+            const uintptr_t current = S::s_liveAddresses[slot].load(std::memory_order_acquire);
+            if (current != 0 && current != S::freedSlot)
+                continue;
+            S::s_liveAllocations[slot] = allocation;
+            S::s_liveTracked.fetch_add(1, std::memory_order_relaxed);
+            S::s_liveAddresses[slot].store(address, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    inline void sampleAllocation(void * ptr, size_t size, size_t mean, AllocThreadState & t)
+    {
+        typedef AllocState<> S;
+        if (!t.random)
+            t.random = ((uint64_t)(uintptr_t)&t * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)clock() ^ 1;
+        if (t.mean != mean)
+        {
+            // the thread's first allocation, or the first since the interval changed, only draws an interval
+            t.mean = mean;
+            t.untilSample = nextSampleInterval(t, mean);
+            return;
+        }
+        t.untilSample = nextSampleInterval(t, mean);
+
+        // sampled with probability 1 - e^(-size/mean), so it stands for 1/p such allocations
+        const double p = -expm1(-(double)size / mean);
+        const uint64_t count = (uint64_t)(1 / p + 0.5);
+        const uint64_t bytes = (uint64_t)(size / p + 0.5);
+
+        // without the frames of this function and onAllocation(), from the hook on
+        const StackTrace stack = StackTrace::capture(2);
+        const uint32_t site = stack.intern();
+        if (site)
+        {
+            AllocSiteStats & stats = S::s_sites[site];
+            stats.samples.fetch_add(1, std::memory_order_relaxed);
+            stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+            stats.count.fetch_add(count ? count : 1, std::memory_order_relaxed);
+            const LiveAllocation allocation = { site, bytes, count ? count : 1 };
+            if (trackLive((uintptr_t)ptr, allocation))
+            {
+                stats.liveBytes.fetch_add(bytes, std::memory_order_relaxed);
+                stats.liveCount.fetch_add(allocation.count, std::memory_order_relaxed);
+            }
+            else
+                S::s_untracked.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+            S::s_untracked.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // called by the hooks after every allocation
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    inline void onAllocation(void * ptr, size_t size)
+    {
+        const size_t mean = AllocState<>::s_sampleBytes.load(std::memory_order_relaxed);
+        if (!mean || !ptr)
+            return;
+        AllocThreadState & t = allocThreadState();
+        t.untilSample -= (int64_t)size;
+        if ((t.untilSample > 0 && t.mean == mean) || t.inProfiler)
+            return;
+        // not a tail call, sampleAllocation() counts on this frame
+        t.inProfiler = true;
+        sampleAllocation(ptr, size, mean, t);
+        t.inProfiler = false;
+    }
+
+    // called by the hooks before every free
+    inline void onFree(void * ptr)
+    {
+        typedef AllocState<> S;
+        if (!ptr || S::s_liveTracked.load(std::memory_order_relaxed) == 0)
+            return;
+        const uintptr_t address = (uintptr_t)ptr;
+        for (int probe = 0; probe < S::maxProbes; probe++)
+        {
+            const size_t slot = liveSlot(address, probe);
+            uintptr_t current = S::s_liveAddresses[slot].load(std::memory_order_acquire);
+            if (current == 0)
+                return;
+            if (current != address)
+                continue;
+            // read before the slot is given up, after that it may be reused
+            const LiveAllocation allocation = S::s_liveAllocations[slot];
+            if (!S::s_liveAddresses[slot].compare_exchange_strong(current, S::freedSlot, std::memory_order_acq_rel))
+                return;
+            S::s_liveTracked.fetch_sub(1, std::memory_order_relaxed);
+            AllocSiteStats & stats = S::s_sites[allocation.site];
+            stats.liveBytes.fetch_sub(allocation.bytes, std::memory_order_relaxed);
+            stats.liveCount.fetch_sub(allocation.count, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    // the report's own allocations are not sampled
+    class AllocProfilerScope
+    {
+    public:
+        AllocProfilerScope() : m_wasIn(allocThreadState().inProfiler) { allocThreadState().inProfiler = true; }
+        ~AllocProfilerScope() { allocThreadState().inProfiler = m_wasIn; }
+
+    private:
+        AllocProfilerScope(const AllocProfilerScope &);
+        AllocProfilerScope & operator=(const AllocProfilerScope &);
+
+        const bool m_wasIn;
+    };
+
+    inline std::string formatAllocBytes(uint64_t bytes)
+    {
+        char buf[32];
+        if (bytes >= 10 * 1024 * 1024)
+            snprintf(buf, sizeof(buf), "%.1f MiB", bytes / (1024.0 * 1024.0));
+        else if (bytes >= 10 * 1024)
+            snprintf(buf, sizeof(buf), "%.1f KiB", bytes / 1024.0);
+        else
+            snprintf(buf, sizeof(buf), "%llu B", (unsigned long long)bytes);
+        return buf;
+    }
+
+    } // namespace detail
+
+inline void startAllocationProfiling(size_t sampleBytes)
+{
+    typedef detail::AllocState<> S;
+    for (int i = 0; i <= DA_STACKTRACE_INTERN_SIZE; i++)
+    {
+        S::s_sites[i].samples.store(0, std::memory_order_relaxed);
+        S::s_sites[i].bytes.store(0, std::memory_order_relaxed);
+        S::s_sites[i].count.store(0, std::memory_order_relaxed);
+    }
+    S::s_untracked.store(0, std::memory_order_relaxed);
+    {
+        // the first capture loads libgcc, which allocates
+        detail::AllocProfilerScope scope;
+        StackTrace::capture();
+    }
+    S::s_sampleBytes.store(sampleBytes > 0 ? sampleBytes : 1, std::memory_order_relaxed);
+}
+
+inline void stopAllocationProfiling()
+{
+    detail::AllocState<>::s_sampleBytes.store(0, std::memory_order_relaxed);
+}
+
+inline size_t allocationSampleBytes()
+{
+    return detail::AllocState<>::s_sampleBytes.load(std::memory_order_relaxed);
+}
+
+inline std::vector<AllocationSite> allocationSites(bool live)
+{
+    typedef detail::AllocState<> S;
+    detail::AllocProfilerScope scope;
+    std::vector<AllocationSite> sites;
+    for (uint32_t id = 1; id <= DA_STACKTRACE_INTERN_SIZE; id++)
+    {
+        const detail::AllocSiteStats & stats = S::s_sites[id];
+        AllocationSite site;
+        site.samples = stats.samples.load(std::memory_order_relaxed);
+        site.bytes = stats.bytes.load(std::memory_order_relaxed);
+        site.count = stats.count.load(std::memory_order_relaxed);
+        site.liveBytes = stats.liveBytes.load(std::memory_order_relaxed);
+        site.liveCount = stats.liveCount.load(std::memory_order_relaxed);
+        const StackTrace * stack = StackTrace::interned(id);
+        if (!stack || (live ? site.liveCount : site.samples) == 0)
+            continue;
+        site.stack = *stack;
+        sites.push_back(site);
+    }
+    std::sort(sites.begin(), sites.end(), [live](const AllocationSite & a, const AllocationSite & b) {
+        return live ? a.liveBytes > b.liveBytes : a.bytes > b.bytes;
+    });
+    return sites;
+}
+
+/**
+ * The top stacks by estimated bytes allocated, or with live, by bytes still
+ * allocated (leaks, at exit), each with its frames.
+ */
+inline std::string allocationReportString(size_t top, bool live)
+{
+    detail::AllocProfilerScope scope;
+    std::vector<AllocationSite> sites = allocationSites(live);
+
+    uint64_t totalBytes = 0;
+    uint64_t totalCount = 0;
+    for (size_t i = 0; i < sites.size(); i++)
+    {
+        totalBytes += live ? sites[i].liveBytes : sites[i].bytes;
+        totalCount += live ? sites[i].liveCount : sites[i].count;
+    }
+
+    std::string s;
+    char line[256];
+    snprintf(line, sizeof(line), "%s: %s in %llu allocations from %d stacks, estimated from samples every %s",
+            live ? "live allocations" : "allocations", detail::formatAllocBytes(totalBytes).c_str(),
+            (unsigned long long)totalCount, (int)sites.size(),
+            allocationSampleBytes() ? detail::formatAllocBytes(allocationSampleBytes()).c_str() : "(stopped)");
+    s += line;
+    const uint64_t untracked = detail::AllocState<>::s_untracked.load(std::memory_order_relaxed);
+    if (untracked)
+    {
+        snprintf(line, sizeof(line), ", %llu samples untracked (tables full)", (unsigned long long)untracked);
+        s += line;
+    }
+    s += '\n';
+
+    for (size_t i = 0; i < sites.size() && i < top; i++)
+    {
+        const AllocationSite & site = sites[i];
+        snprintf(line, sizeof(line), "#%d %s in %llu allocations (%llu samples)",
+                (int)i + 1,
+                detail::formatAllocBytes(live ? site.liveBytes : site.bytes).c_str(),
+                (unsigned long long)(live ? site.liveCount : site.count),
+                (unsigned long long)site.samples);
+        s += line;
+        if (!live && site.liveCount)
+        {
+            snprintf(line, sizeof(line), ", %s live", detail::formatAllocBytes(site.liveBytes).c_str());
+            s += line;
+        }
+        s += '\n';
+        s += site.stack.toString("  ");
+    }
+    return s;
+}
+
+inline void printAllocationReport(FILE * out, size_t top, bool live)
+{
+    detail::AllocProfilerScope scope;
+    const std::string report = allocationReportString(top, live);
+    fwrite(report.data(), 1, report.size(), out);
+    fflush(out);
+}
+
+/**
+ * Prints the top allocating stacks and the live allocations to stderr at
+ * exit. Calling it more than once prints them once.
+ */
+inline void printAllocationReportAtExit(size_t top)
+{
+    static std::atomic<size_t> s_top(0);
+    if (s_top.exchange(top ? top : 1) != 0)
+        return;
+    atexit([]() {
+        printAllocationReport(stderr, s_top.load(), false);
+        printAllocationReport(stderr, s_top.load(), true);
+    });
+}
+
+} // namespace
+
+#if defined(DA_ALLOCPROFILER_DEFINE_OPERATORS)
+
+    namespace da
+    {
+    namespace detail
+    {
+
+    inline void * profiledNew(size_t size)
+    {
+        for (;;)
+        {
+            void * ptr = malloc(size ? size : 1);
+            if (ptr)
+            {
+                onAllocation(ptr, size);
+                return ptr;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    inline void * profiledNewNothrow(size_t size) noexcept
+    {
+        try
+        {
+            return profiledNew(size);
+        }
+        catch (...)
+        {
+            return 0;
+        }
+    }
+
+    inline void profiledDelete(void * ptr) noexcept
+    {
+        onFree(ptr);
+        free(ptr);
+    }
+
+    } // namespace detail
+    } // namespace
+
+void * operator new(size_t size) { return da::detail::profiledNew(size); }
+void * operator new[](size_t size) { return da::detail::profiledNew(size); }
+void * operator new(size_t size, const std::nothrow_t &) noexcept { return da::detail::profiledNewNothrow(size); }
+void * operator new[](size_t size, const std::nothrow_t &) noexcept { return da::detail::profiledNewNothrow(size); }
+void operator delete(void * ptr) noexcept { da::detail::profiledDelete(ptr); }
+void operator delete[](void * ptr) noexcept { da::detail::profiledDelete(ptr); }
+void operator delete(void * ptr, const std::nothrow_t &) noexcept { da::detail::profiledDelete(ptr); }
+void operator delete[](void * ptr, const std::nothrow_t &) noexcept { da::detail::profiledDelete(ptr); }
+#  if defined(__cpp_sized_deallocation)
+void operator delete(void * ptr, size_t) noexcept { da::detail::profiledDelete(ptr); }
+void operator delete[](void * ptr, size_t) noexcept { da::detail::profiledDelete(ptr); }
+#  endif
+// the aligned forms of C++17 are left to the library, their memory doesn't come from malloc()
+
+#elif defined(DA_ALLOCPROFILER_DEFINE_MALLOC)
+#  if !defined(__GLIBC__)
+#    error "DA_ALLOCPROFILER_DEFINE_MALLOC needs glibc"
+#  endif
+
+extern "C"
+{
+
+void * __libc_malloc(size_t size);
+void * __libc_calloc(size_t count, size_t size);
+void * __libc_realloc(void * ptr, size_t size);
+void * __libc_memalign(size_t alignment, size_t size);
+void * __libc_valloc(size_t size);
+void * __libc_pvalloc(size_t size);
+void __libc_free(void * ptr);
+
+void * malloc(size_t size)
+{
+    void * ptr = __libc_malloc(size);
+    da::detail::onAllocation(ptr, size);
+    return ptr;
+}
+
+void * calloc(size_t count, size_t size)
+{
+    void * ptr = __libc_calloc(count, size);
+    da::detail::onAllocation(ptr, count * size);
+    return ptr;
+}
+
+void * realloc(void * ptr, size_t size)
+{
+    // forgotten first: once realloc() freed it the address can be allocated again by another thread
+    da::detail::onFree(ptr);
+    void * moved = __libc_realloc(ptr, size);
+    da::detail::onAllocation(moved, size);
+    return moved;
+}
+
+void * memalign(size_t alignment, size_t size)
+{
+    void * ptr = __libc_memalign(alignment, size);
+    da::detail::onAllocation(ptr, size);
+    return ptr;
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+    void * ptr = __libc_memalign(alignment, size);
+    da::detail::onAllocation(ptr, size);
+    return ptr;
+}
+
+int posix_memalign(void ** result, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+        return EINVAL;
+    void * ptr = __libc_memalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    da::detail::onAllocation(ptr, size);
+    *result = ptr;
+    return 0;
+}
+
+void * valloc(size_t size)
+{
+    void * ptr = __libc_valloc(size);
+    da::detail::onAllocation(ptr, size);
+    return ptr;
+}
+
+void * pvalloc(size_t size)
+{
+    void * ptr = __libc_pvalloc(size);
+    da::detail::onAllocation(ptr, size);
+    return ptr;
+}
+
+void free(void * ptr)
+{
+    da::detail::onFree(ptr);
+    __libc_free(ptr);
+}
+
+} // extern "C"
+
+#endif
+
+#endif
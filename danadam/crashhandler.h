@@ -0,0 +1,281 @@
+#ifndef DANADAM_CRASH_HANDLER_H_GUARD
+#define DANADAM_CRASH_HANDLER_H_GUARD
+
+/*
+ * Crash handler: on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT writes the
+ * signal and the stack trace, flushes the log, then raises the signal again
+ * with its default action, so the process still dies of it (and dumps core).
+ * Linux/glibc only.
+ *
+ * Inside the handler only async-signal-safe calls are made: write() of text
+ * formatted by hand, backtrace() and backtrace_symbols_fd(), which write the
+ * frames unbuffered without allocating. Frames are not demangled, c++filt
+ * does that afterwards. Without the "-rdynamic" linker option they are
+ * "file(+offset)", for addr2line; symbolizer.h allocates, so it can't be used
+ * here. da::installCrashHandler() prepares everything the handler needs:
+ *
+ *  - an alternate signal stack for the calling thread, so a stack overflow
+ *    can be reported too (other threads call da::installCrashAltStack()),
+ *  - a backtrace() call, which loads libgcc and walks the loaded objects
+ *    once; otherwise the first crash would do it, inside dl_iterate_phdr()
+ *    and malloc(), which may be where it crashed,
+ *  - the log output objects.
+ *
+ * Flushing the log is best effort: a pending batch (see setLogBatching()) and
+ * the binary log (see loggerbin.h) are written if their locks are free. Lines
+ * queued for the async backend are not, they need its thread to format them.
+ *
+ * Example:
+ *
+ *      int main()
+ *      {
+ *          da::installCrashHandler();
+ *          ...
+ *      }
+ */
+
+#include <atomic>
+
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "itoa.h"
+#include "loggerbin.h"
+#include "loggercommon.h"
+
+#ifndef DA_CRASH_MAX_FRAMES
+#  define DA_CRASH_MAX_FRAMES 64
+#endif
+
+namespace da
+{
+
+inline bool installCrashHandler(int fd = STDERR_FILENO);
+inline bool installCrashAltStack();
+
+    namespace detail
+    {
+
+    template<typename T = void>
+    struct CrashState
+    {
+        static std::atomic<int> s_fd;
+        static std::atomic<long> s_crashingThread;      // 0 until the first crash
+    };
+
+    template<typename T>
+    std::atomic<int> CrashState<T>::s_fd(STDERR_FILENO);
+
+    template<typename T>
+    std::atomic<long> CrashState<T>::s_crashingThread(0);
+
+    static const int crashSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+    inline const char * crashSignalName(int sig)
+    {
+        switch (sig)
+        {
+            case SIGSEGV: return "SIGSEGV";
+            case SIGBUS:  return "SIGBUS";
+            case SIGILL:  return "SIGILL";
+            case SIGFPE:  return "SIGFPE";
+            case SIGABRT: return "SIGABRT";
+        }
+        return "signal";
+    }
+
+    // text assembled in a fixed buffer, then written with one write()
+    class CrashWriter
+    {
+    public:
+        CrashWriter() : m_len(0) { }
+
+        CrashWriter & str(const char * s)
+        {
+            while (*s && m_len < sizeof(m_buf))
+                m_buf[m_len++] = *s++;
+            return *this;
+        }
+
+        CrashWriter & dec(int64_t n)
+        {
+            char buf[24];
+            itoa(n, buf, sizeof(buf));
+            return str(buf);
+        }
+
+        CrashWriter & hex(uintptr_t n)
+        {
+            char buf[2 + 2 * sizeof(n) + 1];
+            char * p = buf + sizeof(buf) - 1;
+            *p = '\0';
+            do
+            {
+                *--p = "0123456789abcdef"[n & 0xf];
+                n >>= 4;
+            } while (n);
+            *--p = 'x';
+            *--p = '0';
+            return str(p);
+        }
+
+        void writeTo(int fd)
+        {
+            const char * data = m_buf;
+            size_t len = m_len;
+            while (len > 0)
+            {
+                const ssize_t written = ::write(fd, data, len);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written <= 0)
+                    break;
+                data += written;
+                len -= written;
+            }
+            m_len = 0;
+        }
+
+    private:
+        char m_buf[256];
+        size_t m_len;
+    };
+
+    class CrashAltStack
+    {
+    public:
+        CrashAltStack() : m_stack(0) { }
+
+        ~CrashAltStack()
+        {
+            if (!m_stack)
+                return;
+            stack_t stack;
+            memset(&stack, 0, sizeof(stack));
+            stack.ss_flags = SS_DISABLE;
+            sigaltstack(&stack, 0);
+            free(m_stack);
+        }
+
+        bool install()
+        {
+            if (m_stack)
+                return true;
+            const size_t size = SIGSTKSZ > 64 * 1024 ? SIGSTKSZ : 64 * 1024;
+            stack_t stack;
+            memset(&stack, 0, sizeof(stack));
+            stack.ss_sp = malloc(size);
+            stack.ss_size = size;
+            if (!stack.ss_sp || sigaltstack(&stack, 0) != 0)
+            {
+                free(stack.ss_sp);
+                return false;
+            }
+            m_stack = stack.ss_sp;
+            return true;
+        }
+
+    private:
+        CrashAltStack(const CrashAltStack &);
+        CrashAltStack & operator=(const CrashAltStack &);
+
+        void * m_stack;
+    };
+
+    // dies of sig, with the default action
+    inline void raiseDefault(int sig)
+    {
+        signal(sig, SIG_DFL);
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, sig);
+        sigprocmask(SIG_UNBLOCK, &set, 0);
+        raise(sig);
+        _exit(128 + sig);   // if the default action doesn't end the process, e.g. a sigqueue()d SIGSEGV
+    }
+
+    inline void crashSignalHandler(int sig, siginfo_t * info, void *)
+    {
+        const long tid = (long)syscall(SYS_gettid);
+        long expected = 0;
+        if (!CrashState<>::s_crashingThread.compare_exchange_strong(expected, tid))
+        {
+            // crashed in the handler: give up; another thread crashed: it is reporting already
+            if (expected == tid)
+                raiseDefault(sig);
+            while (true)
+                pause();
+        }
+
+        const int fd = CrashState<>::s_fd.load();
+        CrashWriter out;
+        out.str("*** ").str(crashSignalName(sig)).str(" (").dec(sig).str(")");
+        if (sig != SIGABRT)
+            out.str(", fault address ").hex((uintptr_t)info->si_addr);
+        out.str(", thread ").dec(tid).str(" ***\n");
+        out.writeTo(fd);
+
+        void * frames[DA_CRASH_MAX_FRAMES];
+        const int count = backtrace(frames, DA_CRASH_MAX_FRAMES);
+        // frames[0] is this handler, frames[1] the signal trampoline
+        if (count > 2)
+            backtrace_symbols_fd(frames + 2, count - 2, fd);
+
+        const bool logFlushed = logOutput().flushFromSignal();
+        const bool binaryLogFlushed = !binaryLog().isOpen() || binaryLog().flushFromSignal();
+        if (!logFlushed || !binaryLogFlushed)
+            out.str("*** the log was locked, it may be missing its last lines ***\n").writeTo(fd);
+
+        raiseDefault(sig);
+    }
+
+    } // namespace detail
+
+/**
+ * Installs the crash handler for the whole process and an alternate signal
+ * stack for the calling thread. The report goes to fd. Returns false if the
+ * handler can't be installed.
+ */
+inline bool installCrashHandler(int fd)
+{
+    detail::CrashState<>::s_fd.store(fd);
+
+    // everything the handler touches is set up here, not in the handler
+    void * frame;
+    backtrace(&frame, 1);
+    detail::logOutput();
+    detail::binaryLog();
+
+    bool ok = installCrashAltStack();
+    for (size_t i = 0; i < sizeof(detail::crashSignals) / sizeof(detail::crashSignals[0]); i++)
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = detail::crashSignalHandler;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        ok = sigaction(detail::crashSignals[i], &action, 0) == 0 && ok;
+    }
+    return ok;
+}
+
+/**
+ * Gives the calling thread an alternate signal stack (freed when the thread
+ * exits), so the crash handler can run even when the thread overflowed its
+ * stack. Calling it again in the same thread does nothing.
+ */
+inline bool installCrashAltStack()
+{
+    static thread_local detail::CrashAltStack t_stack;
+    return t_stack.install();
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef DANADAM_BENCH_H_GUARD
+#define DANADAM_BENCH_H_GUARD
+
+// requires: MyQtDebug.h (for ElapsedTimer.h)
+
+/*
+ * Microbenchmark harness.
+ *
+ * da::bench::Suite::run(name, fn) calls fn() in a loop: first for the warmup
+ * time, then it doubles the iteration count until one batch takes at least
+ * the sample time, then it times that many calls a number of times. Each
+ * sample gives ns per call; the result is their median and median absolute
+ * deviation (MAD), which a few preempted samples don't move the way they move
+ * the mean and the standard deviation.
+ *
+ * Suite::runThreaded(name, threadCount, fn) does the same with threadCount
+ * threads calling fn() at once, each the same number of times. A sample is
+ * the time until the last of them is done, so the result is ns per call of
+ * one thread; it grows with the threads when they contend. fn() has to be
+ * thread safe.
+ *
+ * Results of fn which are not used otherwise have to go through
+ * doNotOptimize(), or the compiler may drop the whole computation.
+ *
+ * Example:
+ *
+ *      da::bench::Suite suite;
+ *      suite.run("itoa", [&]() {
+ *          char buf[32];
+ *          da::bench::doNotOptimize(da::itoa(value, buf, sizeof(buf)));
+ *      });
+ *      suite.print();
+ *      suite.writeJson("results.json");
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ElapsedTimer.h"
+#include "stringutils.h"
+
+namespace da
+{
+
+    namespace bench
+    {
+
+#if defined(__GNUC__)
+    // makes the compiler assume value is read, so computing it can't be dropped
+    template<typename T>
+    inline void doNotOptimize(const T & value)
+    {
+        __asm__ __volatile__ ("" : : "r,m"(value) : "memory");
+    }
+
+    // makes the compiler assume all memory is read and written here
+    inline void clobberMemory()
+    {
+        __asm__ __volatile__ ("" : : : "memory");
+    }
+#else
+    template<typename T>
+    inline void doNotOptimize(const T & value)
+    {
+        static volatile const void * s_sink;
+        s_sink = &value;
+    }
+
+    inline void clobberMemory() { }
+#endif
+
+    struct Options
+    {
+        Options()
+            : warmupNs(50 * 1000 * 1000)
+            , sampleNs(5 * 1000 * 1000)
+            , samples(21)
+        { }
+
+        uint64_t warmupNs;      // fn runs this long before anything is measured
+        uint64_t sampleNs;      // a sample is at least this long
+        int samples;
+    };
+
+    struct Result
+    {
+        std::string name;
+        uint64_t iterations;    // calls per sample
+        int samples;
+        double medianNs;        // per call, like the rest
+        double madNs;
+        double minNs;
+        double maxNs;
+    };
+
+    inline double median(std::vector<double> values)
+    {
+        if (values.empty())
+            return 0;
+        std::sort(values.begin(), values.end());
+        const size_t mid = values.size() / 2;
+        return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+    }
+
+    /**
+     * Threads which call fn() the given number of times each, all at once,
+     * whenever run() is called.
+     */
+    template<typename Fn>
+    class ThreadGang
+    {
+    public:
+        ThreadGang(int threadCount, Fn & fn)
+            : m_fn(fn)
+            , m_iterations(0)
+            , m_round(0)
+            , m_running(0)
+            , m_stop(false)
+        {
+            for (int t = 0; t < threadCount; t++)
+                m_threads.push_back(std::thread(&ThreadGang::work, this));
+        }
+        ~ThreadGang()
+        {
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                m_stop = true;
+            }
+            m_start.notify_all();
+            for (size_t t = 0; t < m_threads.size(); t++)
+                m_threads[t].join();
+        }
+
+        // returns when all threads are done
+        void run(uint64_t iterations)
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            m_iterations = iterations;
+            m_running = m_threads.size();
+            m_round++;
+            m_start.notify_all();
+            while (m_running)
+                m_done.wait(locker);
+        }
+
+    private:
+        ThreadGang(const ThreadGang &);
+        ThreadGang & operator=(const ThreadGang &);
+
+        void work()
+        {
+            uint64_t round = 0;
+            while (true)
+            {
+                uint64_t iterations;
+                {
+                    std::unique_lock<std::mutex> locker(m_mutex);
+                    while (!m_stop && m_round == round)
+                        m_start.wait(locker);
+                    if (m_stop)
+                        return;
+                    round = m_round;
+                    iterations = m_iterations;
+                }
+                for (uint64_t i = 0; i < iterations; i++)
+                    m_fn();
+                std::lock_guard<std::mutex> locker(m_mutex);
+                if (--m_running == 0)
+                    m_done.notify_one();
+            }
+        }
+
+        Fn & m_fn;
+        std::mutex m_mutex;             // guards everything below
+        std::condition_variable m_start;
+        std::condition_variable m_done;
+        uint64_t m_iterations;
+        uint64_t m_round;
+        size_t m_running;
+        bool m_stop;
+        std::vector<std::thread> m_threads;
+    };
+
+    class Suite
+    {
+    public:
+        explicit Suite(const Options & options = Options())
+            : m_options(options)
+        { }
+
+        template<typename Fn>
+        const Result & run(const std::string & name, Fn fn)
+        {
+            return measure(name, [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++)
+                    fn();
+            });
+        }
+
+        template<typename Fn>
+        const Result & runThreaded(const std::string & name, int threadCount, Fn fn)
+        {
+            ThreadGang<Fn> gang(threadCount > 0 ? threadCount : 1, fn);
+            return measure(name, [&](uint64_t iterations) { gang.run(iterations); });
+        }
+
+        // for combining the results of several suites
+        void add(const Result & result) { m_results.push_back(result); }
+
+        const std::vector<Result> & results() const { return m_results; }
+
+        void print(FILE * out = stdout) const
+        {
+            fprintf(out, "%-36s %12s %10s %12s %12s %12s\n", "benchmark", "median ns", "MAD ns", "min ns", "max ns", "iterations");
+            for (size_t i = 0; i < m_results.size(); i++)
+            {
+                const Result & r = m_results[i];
+                fprintf(out, "%-36s %12.1f %10.1f %12.1f %12.1f %12llu\n",
+                        r.name.c_str(), r.medianNs, r.madNs, r.minNs, r.maxNs, (unsigned long long)r.iterations);
+            }
+            fflush(out);
+        }
+
+        std::string toJson() const
+        {
+            std::string json = "{\"benchmarks\":[";
+            char buf[256];
+            for (size_t i = 0; i < m_results.size(); i++)
+            {
+                const Result & r = m_results[i];
+                snprintf(buf, sizeof(buf),
+                        "\"iterations\":%llu,\"samples\":%d,\"median_ns\":%.3f,\"mad_ns\":%.3f,\"min_ns\":%.3f,\"max_ns\":%.3f}",
+                        (unsigned long long)r.iterations, r.samples, r.medianNs, r.madNs, r.minNs, r.maxNs);
+                json += i ? ",\n" : "\n";
+                json += "{\"name\":\"" + escapeString(r.name, "\"", '\\') + "\",";
+                json += buf;
+            }
+            json += "\n]}\n";
+            return json;
+        }
+
+        // returns false if the file can't be written
+        bool writeJson(const char * path) const
+        {
+            FILE * out = fopen(path, "w");
+            if (!out)
+                return false;
+            const std::string json = toJson();
+            fwrite(json.data(), 1, json.size(), out);
+            return fclose(out) == 0;
+        }
+
+    private:
+        // batch(n) calls the benchmarked function n times
+        template<typename BatchFn>
+        const Result & measure(const std::string & name, BatchFn batch)
+        {
+            ElapsedTimer timer(ElapsedTimer::tsc);
+            while (timer.elapsed() < m_options.warmupNs)
+                batch(1);
+
+            uint64_t iterations = 1;
+            while (true)
+            {
+                timer.start();
+                batch(iterations);
+                if (timer.elapsed() >= m_options.sampleNs || iterations >= (1ULL << 40))
+                    break;
+                iterations *= 2;
+            }
+
+            std::vector<double> samples;
+            for (int s = 0; s < m_options.samples; s++)
+            {
+                timer.start();
+                batch(iterations);
+                samples.push_back(double(timer.elapsed()) / iterations);
+            }
+
+            Result result;
+            result.name = name;
+            result.iterations = iterations;
+            result.samples = (int)samples.size();
+            result.medianNs = median(samples);
+            std::vector<double> deviations;
+            for (size_t i = 0; i < samples.size(); i++)
+                deviations.push_back(fabs(samples[i] - result.medianNs));
+            result.madNs = median(deviations);
+            result.minNs = samples.empty() ? 0 : *std::min_element(samples.begin(), samples.end());
+            result.maxNs = samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+            m_results.push_back(result);
+            return m_results.back();
+        }
+
+        Options m_options;
+        std::vector<Result> m_results;
+    };
+
+    } // namespace bench
+
+} // namespace
+
+#endif
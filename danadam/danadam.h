@@ -39,7 +39,7 @@ namespace da
 
 #ifdef DANADAM_STD
 
-// works best with "-O0" compiler option and "-rdynamic" linker option
+// file:line needs "-g", see stacktrace.h for the unwinder and the depth
 inline std::string getStackTrace(const std::string & prefix, int offset);
 
 inline std::string getStackTrace()
@@ -1,9 +1,18 @@
 #ifndef DANADAM_HEX_H_GUARD
 #define DANADAM_HEX_H_GUARD
 
+#include <stddef.h>
 #include <stdint.h>
+#include <algorithm>
 #include <cstring>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define DA_HEX_SIMD 1     // SSE2, SSSE3 and AVX2 kernels, picked at run time
+#  include <immintrin.h>
+#else
+#  define DA_HEX_SIMD 0
+#endif
+
 namespace da
 {
 
@@ -15,8 +24,7 @@ static inline bool ishex(char c)
 }
 inline char enhex(uint8_t b)
 {
-    b = b & 0x0f;
-    return b + (b < 10 ? '0' : -10 + 'a');
+    return "0123456789abcdef"[b & 0x0f];
 }
 inline uint8_t dehex(char c)
 {
@@ -25,16 +33,153 @@ inline uint8_t dehex(char c)
             (c - 'A' < 'G' - 'A') ? (c - 'A' + 10) :   // if uppercase letter
                 -1;                                    // wrong hex
 }
+
+    namespace detail
+    {
+
+    typedef char * (*HexEncodeFn)(char * dst, const uint8_t * src, size_t len);
+
+    inline char * hexEncodeScalar(char * dst, const uint8_t * src, size_t len)
+    {
+        static const char digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; i++)
+        {
+            dst[2*i] = digits[src[i] >> 4];
+            dst[2*i + 1] = digits[src[i] & 0x0f];
+        }
+        return dst + 2*len;
+    }
+
+#if DA_HEX_SIMD
+    // 16 bytes -> 32 digits: nibble + '0', plus the gap up to 'a' where the nibble is above 9
+    __attribute__((target("sse2")))
+    inline char * hexEncodeSse2(char * dst, const uint8_t * src, size_t len)
+    {
+        const __m128i mask = _mm_set1_epi8(0x0f);
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i zero = _mm_set1_epi8('0');
+        const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16)
+        {
+            const __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+            const __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+            const __m128i lo = _mm_and_si128(in, mask);
+            const __m128i hiDigits = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), gap));
+            const __m128i loDigits = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), gap));
+            _mm_storeu_si128((__m128i *)(dst + 2*i), _mm_unpacklo_epi8(hiDigits, loDigits));
+            _mm_storeu_si128((__m128i *)(dst + 2*i + 16), _mm_unpackhi_epi8(hiDigits, loDigits));
+        }
+        return hexEncodeScalar(dst + 2*i, src + i, len - i);
+    }
+
+    // 16 bytes -> 32 digits, each nibble looked up with pshufb
+    __attribute__((target("ssse3")))
+    inline char * hexEncodeSsse3(char * dst, const uint8_t * src, size_t len)
+    {
+        const __m128i mask = _mm_set1_epi8(0x0f);
+        const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16)
+        {
+            const __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+            const __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+            const __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, mask));
+            _mm_storeu_si128((__m128i *)(dst + 2*i), _mm_unpacklo_epi8(hi, lo));
+            _mm_storeu_si128((__m128i *)(dst + 2*i + 16), _mm_unpackhi_epi8(hi, lo));
+        }
+        return hexEncodeScalar(dst + 2*i, src + i, len - i);
+    }
+
+    // 32 bytes -> 64 digits; the unpacks work within 128-bit lanes, the permutes put the lanes in order
+    __attribute__((target("avx2")))
+    inline char * hexEncodeAvx2(char * dst, const uint8_t * src, size_t len)
+    {
+        const __m256i mask = _mm256_set1_epi8(0x0f);
+        const __m256i digits = _mm256_setr_epi8(
+                '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32)
+        {
+            const __m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+            const __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+            const __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(in, mask));
+            const __m256i first = _mm256_unpacklo_epi8(hi, lo);     // bytes 0-7 and 16-23
+            const __m256i second = _mm256_unpackhi_epi8(hi, lo);    // bytes 8-15 and 24-31
+            _mm256_storeu_si256((__m256i *)(dst + 2*i), _mm256_permute2x128_si256(first, second, 0x20));
+            _mm256_storeu_si256((__m256i *)(dst + 2*i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+        }
+        return hexEncodeSsse3(dst + 2*i, src + i, len - i);
+    }
+#endif
+
+    inline HexEncodeFn selectHexEncoder()
+    {
+#if DA_HEX_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return hexEncodeAvx2;
+        if (__builtin_cpu_supports("ssse3"))
+            return hexEncodeSsse3;
+        if (__builtin_cpu_supports("sse2"))
+            return hexEncodeSse2;
+#endif
+        return hexEncodeScalar;
+    }
+
+    // picked on the first call
+    inline HexEncodeFn hexEncoder()
+    {
+        static const HexEncodeFn s_encode = selectHexEncoder();
+        return s_encode;
+    }
+
+    } // namespace detail
+
+/**
+ * Writes 2*len lowercase hex digits of src to dst, without a '\0', and
+ * returns the end of them. Uses the widest kernel the CPU supports.
+ */
+inline char * hexEncode(char * dst, const void * src, size_t len)
+{
+    return detail::hexEncoder()(dst, static_cast<const uint8_t *>(src), len);
+}
+
+// "avx2", "ssse3", "sse2" or "scalar"
+inline const char * hexEncoderName()
+{
+    const detail::HexEncodeFn encode = detail::hexEncoder();
+#if DA_HEX_SIMD
+    if (encode == detail::hexEncodeAvx2)
+        return "avx2";
+    if (encode == detail::hexEncodeSsse3)
+        return "ssse3";
+    if (encode == detail::hexEncodeSse2)
+        return "sse2";
+#endif
+    (void)encode;
+    return "scalar";
+}
+
 inline char * hexdumpLineRaw(const uint8_t * data, int64_t dataLen)
 {
     char * const hex = new char[3*dataLen];
     char * cur = hex;
-    for (int i = 0; i < dataLen; i++)
+    char digits[2*64];
+    for (int64_t i = 0; i < dataLen; i += 64)
     {
-        *(cur++) = enhex(data[i] >> 4);
-        *(cur++) = enhex(data[i]);
-        *(cur++) = (i+1 < dataLen) ? ' ' : '\0';
+        const int64_t chunk = std::min<int64_t>(64, dataLen - i);
+        hexEncode(digits, data + i, chunk);
+        for (int64_t j = 0; j < chunk; j++)
+        {
+            *(cur++) = digits[2*j];
+            *(cur++) = digits[2*j + 1];
+            *(cur++) = ' ';
+        }
     }
+    if (dataLen > 0)
+        cur[-1] = '\0';
     return hex;
 }
 inline char * hexdumpLineRaw(const char * data, int64_t dataLen)
@@ -55,6 +200,7 @@ inline char * hexdumpRaw(const uint8_t * data, int64_t dataLen)
     memcpy(cur, header, lineLength);    // copied without '\0'
     cur += lineLength;
     int last_LF_idx = (cur - hex) - 1;
+    char lineDigits[2*16];
     for (int i = 0; i < dataLen; i++)
     {
         const int bytePosInLine = i % 16;
@@ -62,6 +208,7 @@ inline char * hexdumpRaw(const uint8_t * data, int64_t dataLen)
         // offset part
         if (bytePosInLine == 0)          // if this is the beginning of the line
         {
+            hexEncode(lineDigits, data + i, std::min<int64_t>(16, dataLen - i));
             *(cur++) = enhex(i >> 12);
             *(cur++) = enhex(i >>  8);
             *(cur++) = enhex(i >>  4);
@@ -70,8 +217,8 @@ inline char * hexdumpRaw(const uint8_t * data, int64_t dataLen)
         }
 
         // hex part
-        *(cur++) = enhex(data[i] >> 4);
-        *(cur++) = enhex(data[i]);
+        *(cur++) = lineDigits[2*bytePosInLine];
+        *(cur++) = lineDigits[2*bytePosInLine + 1];
 
         if (i+1 < dataLen)               // if there is more data
         {
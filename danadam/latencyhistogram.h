@@ -0,0 +1,224 @@
+#ifndef DANADAM_LATENCY_HISTOGRAM_H_GUARD
+#define DANADAM_LATENCY_HISTOGRAM_H_GUARD
+
+/*
+ * Log-linear latency histogram, in the style of HdrHistogram.
+ *
+ * Values (nanoseconds, e.g. from ElapsedTimer::elapsed()) below 2^subBits
+ * have a bucket each. Above that each power of two is split into
+ * 2^(subBits-1) equal buckets, so a bucket is never wider than 1/2^(subBits-1)
+ * of its values: with the default of 8 bits percentiles are within 0.8%. The
+ * whole 64 bit range fits in a fixed array of (66 - subBits) * 2^(subBits-1)
+ * counters (58 KiB with 8 bits), allocated once in the constructor.
+ *
+ * record() is a shift, a count-leading-zeros and one relaxed atomic increment
+ * (min and max are only written when they change), so threads may share a
+ * histogram. A histogram per thread, merged for the report, avoids bouncing
+ * the cache lines of the popular buckets between cores.
+ *
+ * Example:
+ *
+ *      da::LatencyHistogram histogram;
+ *      ...
+ *      ElapsedTimer timer(ElapsedTimer::tsc);
+ *      handleRequest();
+ *      histogram.record(timer.elapsed());
+ *      ...
+ *      printf("%s\n", histogram.toString().c_str());   // count=... p50=... p99=... p99.9=...
+ */
+
+#include <atomic>
+#include <string>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef DA_LATENCY_HISTOGRAM_SUB_BITS
+#  define DA_LATENCY_HISTOGRAM_SUB_BITS 8
+#endif
+
+namespace da
+{
+
+class LatencyHistogram
+{
+public:
+    static const int subBits = DA_LATENCY_HISTOGRAM_SUB_BITS;
+    static const int bucketCount = (66 - subBits) << (subBits - 1);
+
+    LatencyHistogram()
+        : m_counts(new std::atomic<uint64_t>[bucketCount])
+    {
+        reset();
+    }
+    ~LatencyHistogram() { delete[] m_counts; }
+
+    void record(uint64_t value)
+    {
+        m_counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        // the loads keep the common case free of read-modify-writes
+        if (value < m_min.load(std::memory_order_relaxed))
+            storeMin(value);
+        if (value > m_max.load(std::memory_order_relaxed))
+            storeMax(value);
+    }
+
+    // adds the counts of other, which may still be recorded to
+    void merge(const LatencyHistogram & other)
+    {
+        for (int i = 0; i < bucketCount; i++)
+        {
+            const uint64_t n = other.m_counts[i].load(std::memory_order_relaxed);
+            if (n)
+                m_counts[i].fetch_add(n, std::memory_order_relaxed);
+        }
+        storeMin(other.m_min.load(std::memory_order_relaxed));
+        storeMax(other.m_max.load(std::memory_order_relaxed));
+    }
+
+    // not atomic with respect to concurrent record() calls
+    void reset()
+    {
+        for (int i = 0; i < bucketCount; i++)
+            m_counts[i].store(0, std::memory_order_relaxed);
+        m_min.store(UINT64_MAX, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    // sums the buckets, there is no separate counter to increment in record()
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (int i = 0; i < bucketCount; i++)
+            total += m_counts[i].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t min() const { return count() ? m_min.load(std::memory_order_relaxed) : 0; }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    /**
+     * The value below or at which "percentile" percent of the recorded values
+     * are (e.g. 99.9), as the highest value of its bucket but not more than
+     * max(). 0 if nothing was recorded.
+     */
+    uint64_t percentile(double percentile) const
+    {
+        const uint64_t total = count();
+        if (total == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)ceil(percentile / 100.0 * total);
+        if (rank < 1)
+            rank = 1;
+        if (rank > total)
+            rank = total;
+
+        const uint64_t maxValue = max();
+        uint64_t seen = 0;
+        for (int i = 0; i < bucketCount; i++)
+        {
+            seen += m_counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return bucketHighest(i) < maxValue ? bucketHighest(i) : maxValue;
+        }
+        return maxValue;
+    }
+
+    // "count=1000 min=1 p50=500 p90=900 p99=990 p99.9=999 max=1000"
+    std::string toString() const
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "count=%llu min=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu",
+                (unsigned long long)count(),
+                (unsigned long long)min(),
+                (unsigned long long)percentile(50),
+                (unsigned long long)percentile(90),
+                (unsigned long long)percentile(99),
+                (unsigned long long)percentile(99.9),
+                (unsigned long long)max()
+            );
+        return buf;
+    }
+
+    // "lowest,highest,count" of every non-empty bucket, after a header line
+    std::string toCsv() const
+    {
+        std::string csv = "lowest,highest,count\n";
+        char buf[80];
+        for (int i = 0; i < bucketCount; i++)
+        {
+            const uint64_t n = m_counts[i].load(std::memory_order_relaxed);
+            if (!n)
+                continue;
+            snprintf(buf, sizeof(buf), "%llu,%llu,%llu\n",
+                    (unsigned long long)bucketLowest(i),
+                    (unsigned long long)bucketHighest(i),
+                    (unsigned long long)n
+                );
+            csv += buf;
+        }
+        return csv;
+    }
+
+    static int bucketIndex(uint64_t value)
+    {
+        if (value < (1ULL << subBits))
+            return (int)value;
+        const int shift = highestBit(value) - subBits + 1;
+        return (shift << (subBits - 1)) + (int)(value >> shift);
+    }
+
+    static uint64_t bucketLowest(int index)
+    {
+        if (index < (1 << (subBits - 1)))
+            return index;
+        const int shift = (index >> (subBits - 1)) - 1;
+        return (uint64_t)(index - (shift << (subBits - 1))) << shift;
+    }
+
+    static uint64_t bucketHighest(int index)
+    {
+        const int shift = index < (1 << (subBits - 1)) ? 0 : (index >> (subBits - 1)) - 1;
+        return bucketLowest(index) + ((1ULL << shift) - 1);
+    }
+
+private:
+    LatencyHistogram(const LatencyHistogram &);
+    LatencyHistogram & operator=(const LatencyHistogram &);
+
+    static int highestBit(uint64_t value)
+    {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 0;
+        while (value >>= 1)
+            bit++;
+        return bit;
+#endif
+    }
+
+    void storeMin(uint64_t value)
+    {
+        uint64_t current = m_min.load(std::memory_order_relaxed);
+        while (value < current && !m_min.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            ;
+    }
+
+    void storeMax(uint64_t value)
+    {
+        uint64_t current = m_max.load(std::memory_order_relaxed);
+        while (value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            ;
+    }
+
+    std::atomic<uint64_t> * const m_counts;
+    std::atomic<uint64_t> m_min;
+    std::atomic<uint64_t> m_max;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef DANADAM_LOGGER_ARGS_H_GUARD
+#define DANADAM_LOGGER_ARGS_H_GUARD
+
+/*
+ * Capturing printf() arguments now and formatting them later, used by the
+ * binary log (loggerbin.h) and the asynchronous backend (loggerasync.h).
+ *
+ * Arithmetic and enum values are stored as 64 bit integers or doubles,
+ * pointers as their address and C strings as a copy of up to
+ * DA_LOG_BINARY_MAX_STRING bytes. formatBinaryMessage() then formats them
+ * with the original format string.
+ */
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef DA_LOG_BINARY_MAX_STRING
+#  define DA_LOG_BINARY_MAX_STRING 1024
+#endif
+
+namespace da
+{
+
+    namespace detail
+    {
+
+    static const uint32_t BINARY_NULL_STRING = 0xffffffff;
+
+    struct BinaryArgValue
+    {
+        BinaryArgValue() : type(0), isNull(false) { v.u = 0; }
+
+        char type;      // 'i', 'u', 'd', 'p' or 's'
+        union { int64_t i; uint64_t u; double d; } v;
+        std::string s;
+        bool isNull;
+    };
+
+    // --- argument encoding ----------------
+
+    template<typename T, typename Enable = void>
+    struct BinaryArg
+    {
+        static_assert(sizeof(T) == 0, "LOGF takes only arithmetic, enum, pointer and C string arguments");
+    };
+
+    template<typename T>
+    struct BinaryArg<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>
+    {
+        static const bool isSigned = std::is_signed<T>::value || std::is_enum<T>::value;
+        static char code() { return isSigned ? 'i' : 'u'; }
+        static size_t size(T) { return sizeof(uint64_t); }
+        template<typename WriterT>
+        static void put(WriterT & w, T value)
+        {
+            const uint64_t raw = isSigned ? (uint64_t)(int64_t)value : (uint64_t)value;
+            w.put(&raw, sizeof(raw));
+        }
+        static BinaryArgValue value(T value)
+        {
+            BinaryArgValue arg;
+            arg.type = code();
+            arg.v.u = isSigned ? (uint64_t)(int64_t)value : (uint64_t)value;
+            return arg;
+        }
+    };
+
+    template<typename T>
+    struct BinaryArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+    {
+        static char code() { return 'd'; }
+        static size_t size(T) { return sizeof(double); }
+        template<typename WriterT>
+        static void put(WriterT & w, T value)
+        {
+            const double raw = value;
+            w.put(&raw, sizeof(raw));
+        }
+        static BinaryArgValue value(T value)
+        {
+            BinaryArgValue arg;
+            arg.type = code();
+            arg.v.d = value;
+            return arg;
+        }
+    };
+
+    template<typename T>
+    struct BinaryArg<T, typename std::enable_if<
+            (std::is_pointer<T>::value
+                    && !std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value)
+                || std::is_same<T, std::nullptr_t>::value
+        >::type>
+    {
+        static char code() { return 'p'; }
+        static size_t size(T) { return sizeof(uint64_t); }
+        template<typename WriterT>
+        static void put(WriterT & w, T value)
+        {
+            const uint64_t raw = (uintptr_t)value;
+            w.put(&raw, sizeof(raw));
+        }
+        static BinaryArgValue value(T value)
+        {
+            BinaryArgValue arg;
+            arg.type = code();
+            arg.v.u = (uintptr_t)value;
+            return arg;
+        }
+    };
+
+    template<typename T>
+    struct BinaryArg<T, typename std::enable_if<
+            std::is_pointer<T>::value
+                && std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value
+        >::type>
+    {
+        static char code() { return 's'; }
+        static uint32_t length(const char * value)
+        {
+            if (!value)
+                return 0;
+            const size_t len = strlen(value);
+            return len < DA_LOG_BINARY_MAX_STRING ? len : DA_LOG_BINARY_MAX_STRING;
+        }
+        static size_t size(const char * value) { return sizeof(uint32_t) + length(value); }
+        template<typename WriterT>
+        static void put(WriterT & w, const char * value)
+        {
+            const uint32_t len = value ? length(value) : BINARY_NULL_STRING;
+            w.put(&len, sizeof(len));
+            if (value)
+                w.put(value, len);
+        }
+        static BinaryArgValue value(const char * value)
+        {
+            BinaryArgValue arg;
+            arg.type = code();
+            arg.isNull = !value;
+            if (value)
+                arg.s.assign(value, length(value));
+            return arg;
+        }
+    };
+
+    template<typename... T>
+    struct BinaryArgTypes
+    {
+        static const char * str()
+        {
+            static const char s_types[] = { BinaryArg<T>::code()..., '\0' };
+            return s_types;
+        }
+    };
+
+    inline size_t binaryArgsSize() { return 0; }
+    template<typename T, typename... Rest>
+    size_t binaryArgsSize(const T & value, const Rest &... rest)
+    {
+        return BinaryArg<typename std::decay<T>::type>::size(value) + binaryArgsSize(rest...);
+    }
+
+    template<typename WriterT>
+    void putBinaryArgs(WriterT &) { }
+    template<typename WriterT, typename T, typename... Rest>
+    void putBinaryArgs(WriterT & w, const T & value, const Rest &... rest)
+    {
+        BinaryArg<typename std::decay<T>::type>::put(w, value);
+        putBinaryArgs(w, rest...);
+    }
+
+    inline void binaryArgValues(std::vector<BinaryArgValue> &) { }
+    template<typename T, typename... Rest>
+    void binaryArgValues(std::vector<BinaryArgValue> & values, const T & value, const Rest &... rest)
+    {
+        values.push_back(BinaryArg<typename std::decay<T>::type>::value(value));
+        binaryArgValues(values, rest...);
+    }
+
+    struct BinaryBufferWriter
+    {
+        BinaryBufferWriter(char * buf) : buf(buf), len(0) { }
+        void put(const void * src, size_t n) { memcpy(buf + len, src, n); len += n; }
+
+        char * buf;
+        size_t len;
+    };
+
+    // Reads back what putBinaryArgs() wrote for arguments of the given types.
+    // Returns false if "data" is too short.
+    inline bool readBinaryArgValues(const char * types, const char * data, size_t size, std::vector<BinaryArgValue> & values)
+    {
+        const char * const end = data + size;
+        values.resize(strlen(types));
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            BinaryArgValue & arg = values[i];
+            arg.type = types[i];
+            arg.isNull = false;
+            if (arg.type == 's')
+            {
+                uint32_t len;
+                if ((size_t)(end - data) < sizeof(len))
+                    return false;
+                memcpy(&len, data, sizeof(len));
+                data += sizeof(len);
+                arg.isNull = len == BINARY_NULL_STRING;
+                arg.s.clear();
+                if (arg.isNull)
+                    continue;
+                if ((size_t)(end - data) < len)
+                    return false;
+                arg.s.assign(data, len);
+                data += len;
+            }
+            else
+            {
+                if ((size_t)(end - data) < sizeof(arg.v))
+                    return false;
+                memcpy(&arg.v, data, sizeof(arg.v));
+                data += sizeof(arg.v);
+            }
+        }
+        return true;
+    }
+
+    // --- formatting ----------------
+
+    template<typename T>
+    int snprintfSpec(char * buf, size_t size, const std::string & spec, int starCount, const int * stars, T value)
+    {
+        switch (starCount)
+        {
+            case 0: return snprintf(buf, size, spec.c_str(), value);
+            case 1: return snprintf(buf, size, spec.c_str(), stars[0], value);
+            default: return snprintf(buf, size, spec.c_str(), stars[0], stars[1], value);
+        }
+    }
+
+    template<typename T>
+    void appendFormatted(std::string & out, const std::string & spec, int starCount, const int * stars, T value)
+    {
+        char buf[128];
+        const int len = snprintfSpec(buf, sizeof(buf), spec, starCount, stars, value);
+        if (len < 0)
+            return;
+        if ((size_t)len < sizeof(buf))
+        {
+            out.append(buf, len);
+            return;
+        }
+        std::vector<char> big(len + 1);
+        snprintfSpec(&big[0], big.size(), spec, starCount, stars, value);
+        out.append(&big[0], len);
+    }
+
+    inline int64_t binaryArgInt(const BinaryArgValue & arg)
+    {
+        return arg.type == 'd' ? (int64_t)arg.v.d : arg.v.i;
+    }
+    inline double binaryArgDouble(const BinaryArgValue & arg)
+    {
+        return arg.type == 'd' ? arg.v.d : arg.type == 'i' ? (double)arg.v.i : (double)arg.v.u;
+    }
+
+    /**
+     * printf() replacement working on already captured arguments. Each
+     * conversion is formatted separately by snprintf() with its original
+     * flags, width, precision and length modifier.
+     */
+    inline std::string formatBinaryMessage(const char * fmt, const std::vector<BinaryArgValue> & args)
+    {
+        std::string out;
+        size_t next = 0;
+        const char * c = fmt;
+        while (*c)
+        {
+            if (*c != '%')
+            {
+                const char * percent = strchr(c, '%');
+                const size_t len = percent ? (size_t)(percent - c) : strlen(c);
+                out.append(c, len);
+                c += len;
+                continue;
+            }
+            if (c[1] == '%')
+            {
+                out += '%';
+                c += 2;
+                continue;
+            }
+
+            // --- parse: "%" [flags] [width] ["." precision] [length] conversion
+            const char * s = c + 1;
+            std::string spec("%");
+            int stars[2];
+            int starCount = 0;
+            while (*s && strchr("-+ #0'", *s))
+                spec += *s++;
+            for (int part = 0; part < 2; part++)
+            {
+                if (part == 1)
+                {
+                    if (*s != '.')
+                        break;
+                    spec += *s++;
+                }
+                if (*s == '*')
+                {
+                    spec += *s++;
+                    stars[starCount++] = next < args.size() ? (int)binaryArgInt(args[next++]) : 0;
+                }
+                else
+                {
+                    while (isdigit((unsigned char)*s))
+                        spec += *s++;
+                }
+            }
+            std::string length;
+            while (*s && strchr("hlLqjzt", *s))
+                length += *s++;
+            const char conv = *s;
+            if (!conv)
+            {
+                out.append(c);
+                break;
+            }
+            c = s + 1;
+
+            if (next >= args.size())
+            {
+                out += "<missing>";
+                continue;
+            }
+            const BinaryArgValue & arg = args[next++];
+
+            // --- format
+            switch (conv)
+            {
+                case 'd':
+                case 'i':
+                {
+                    const int64_t v = binaryArgInt(arg);
+                    if (length == "l" || length == "ll" || length == "q" || length == "j" || length == "z" || length == "t")
+                        appendFormatted(out, spec + "ll" + conv, starCount, stars, (long long)v);
+                    else
+                        appendFormatted(out, spec + conv, starCount, stars, (int)v);
+                    break;
+                }
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                {
+                    const uint64_t v = (uint64_t)binaryArgInt(arg);
+                    if (length == "l" || length == "ll" || length == "q" || length == "j" || length == "z" || length == "t")
+                        appendFormatted(out, spec + "ll" + conv, starCount, stars, (unsigned long long)v);
+                    else if (length == "hh")
+                        appendFormatted(out, spec + conv, starCount, stars, (unsigned)(unsigned char)v);
+                    else if (length == "h")
+                        appendFormatted(out, spec + conv, starCount, stars, (unsigned)(unsigned short)v);
+                    else
+                        appendFormatted(out, spec + conv, starCount, stars, (unsigned)v);
+                    break;
+                }
+                case 'c':
+                    appendFormatted(out, spec + conv, starCount, stars, (int)binaryArgInt(arg));
+                    break;
+                case 'f': case 'F':
+                case 'e': case 'E':
+                case 'g': case 'G':
+                case 'a': case 'A':
+                    appendFormatted(out, spec + conv, starCount, stars, binaryArgDouble(arg));
+                    break;
+                case 's':
+                    if (arg.type != 's')
+                        out += "<?>";
+                    else
+                        appendFormatted(out, spec + conv, starCount, stars, arg.isNull ? "(null)" : arg.s.c_str());
+                    break;
+                case 'p':
+                    appendFormatted(out, spec + conv, starCount, stars, (void *)(uintptr_t)arg.v.u);
+                    break;
+                case 'n':
+                    break;
+                default:
+                    out.append(spec).append(length).append(1, conv);
+                    break;
+            }
+        }
+        return out;
+    }
+
+    } // namespace detail
+
+} // namespace
+
+#endif
@@ -0,0 +1,599 @@
+#ifndef DANADAM_LOGGER_ASYNC_H_GUARD
+#define DANADAM_LOGGER_ASYNC_H_GUARD
+
+/*
+ * Opt-in asynchronous backend for da::logf() (and so for LOGF/TRACEF and
+ * the Qt LOG macros).
+ *
+ * After da::startAsyncLogging() every thread gets its own bounded lock-free
+ * queue of fixed size records. LOGF only copies the raw timestamp and the
+ * arguments (see loggerargs.h) into a free slot, one background thread
+ * formats the date, the header and the message and writes whatever it
+ * drained in one go. Lines of one thread keep their order, lines of different
+ * threads may be interleaved differently than they were logged.
+ *
+ * If the arguments take more than DA_LOG_ASYNC_MSG_SIZE bytes, and for direct
+ * da::logf() calls (the varargs can't outlive the call), the caller formats
+ * the message body; then longer messages are truncated and end with "...".
+ * The "file" and format arguments must point to strings with static storage
+ * duration (__FILE__ and literals do).
+ *
+ * Example:
+ *
+ *      da::startAsyncLogging(da::EOverflowPolicy::dropOldest, 4096);
+ *      TRACEF("logged from the background thread");
+ *      da::flushLogs();    // everything logged so far is written now
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "loggerargs.h"
+
+#ifndef DA_LOG_ASYNC_MSG_SIZE
+#  define DA_LOG_ASYNC_MSG_SIZE 464
+#endif
+#ifndef DA_LOG_ASYNC_WRITE_SIZE
+#  define DA_LOG_ASYNC_WRITE_SIZE (64 * 1024)   // drained lines are written in chunks of about this size
+#endif
+
+namespace da
+{
+
+/**
+ * What a thread does when its queue is full.
+ */
+struct EOverflowPolicy
+{
+    enum E
+    {
+        block,          // wait until the background thread makes room
+        dropNewest,     // discard the message being logged
+        dropOldest      // discard the oldest queued message
+    };
+};
+
+inline void startAsyncLogging(EOverflowPolicy::E policy = EOverflowPolicy::block, int queueSize = 1024);
+inline void stopAsyncLogging();
+inline void flushLogs();
+
+    namespace detail
+    {
+
+    struct AsyncLogRecord
+    {
+        std::atomic<size_t> sequence;
+        char datetime[DATETIME_BUF_LEN];    // empty if there was none or it is still to be formatted
+        bool hasTime;                       // "time" is to be formatted as the datetime
+        struct timeval time;
+        const char * level;
+        const char * file;
+        int line;
+        const char * fmt;                   // if set, "msg" holds its arguments (putBinaryArgs())
+        const char * types;                 // BinaryArgTypes of those arguments
+        int msgLen;
+        char msg[DA_LOG_ASYNC_MSG_SIZE];
+    };
+
+    /**
+     * Bounded queue by Dmitry Vyukov. It is multi-producer multi-consumer, but
+     * here there is only one producer (the owning thread) and two consumers:
+     * the background thread and, with EOverflowPolicy::dropOldest, the owning
+     * thread itself.
+     */
+    class AsyncLogQueue
+    {
+    public:
+        AsyncLogQueue(size_t size, int generation)
+            : m_generation(generation)
+            , m_mask(size - 1)
+            , m_records(new AsyncLogRecord[size])
+            , m_enqueuePos(0)
+            , m_dequeuePos(0)
+            , m_done(0)
+            , m_written(0)
+            , m_dropped(0)
+        {
+            for (size_t i = 0; i < size; i++)
+                m_records[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // Returns a slot to fill and pass to endPush() or 0 if the queue is full.
+        AsyncLogRecord * beginPush()
+        {
+            size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                AsyncLogRecord * rec = &m_records[pos & m_mask];
+                const size_t seq = rec->sequence.load(std::memory_order_acquire);
+                const ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+                if (diff == 0)
+                {
+                    if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        return rec;
+                }
+                else if (diff < 0)
+                    return 0;
+                else
+                    pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        void endPush(AsyncLogRecord * rec)
+        {
+            rec->sequence.store(m_enqueuePos.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+
+        // Returns the oldest record to read and pass to endPop() (with pos) or 0 if the queue is empty.
+        AsyncLogRecord * beginPop(size_t * popped)
+        {
+            size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                AsyncLogRecord * rec = &m_records[pos & m_mask];
+                const size_t seq = rec->sequence.load(std::memory_order_acquire);
+                const ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+                if (diff == 0)
+                {
+                    if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        *popped = pos;
+                        return rec;
+                    }
+                }
+                else if (diff < 0)
+                    return 0;
+                else
+                    pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        void endPop(AsyncLogRecord * rec, size_t pos)
+        {
+            rec->sequence.store(pos + m_mask + 1, std::memory_order_release);
+            m_done.fetch_add(1, std::memory_order_release);
+        }
+        bool dropOldest()
+        {
+            size_t pos = 0;
+            AsyncLogRecord * rec = beginPop(&pos);
+            if (!rec)
+                return false;
+            endPop(rec, pos);
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        void dropNewest() { m_dropped.fetch_add(1, std::memory_order_relaxed); }
+
+        size_t pushed() const { return m_enqueuePos.load(std::memory_order_acquire); }
+        size_t done() const { return m_done.load(std::memory_order_acquire); }
+        // records popped (written or dropped) before the background thread's last write() returned
+        size_t written() const { return m_written.load(std::memory_order_acquire); }
+        void setWritten(size_t done) { m_written.store(done, std::memory_order_release); }
+        size_t takeDropped() { return m_dropped.exchange(0, std::memory_order_relaxed); }
+        int generation() const { return m_generation; }
+
+    private:
+        AsyncLogQueue(const AsyncLogQueue &);
+        AsyncLogQueue & operator=(const AsyncLogQueue &);
+
+        const int m_generation;
+        const size_t m_mask;
+        std::unique_ptr<AsyncLogRecord[]> m_records;
+        alignas(64) std::atomic<size_t> m_enqueuePos;
+        alignas(64) std::atomic<size_t> m_dequeuePos;
+        alignas(64) std::atomic<size_t> m_done;
+        std::atomic<size_t> m_written;
+        std::atomic<size_t> m_dropped;
+    };
+
+    class AsyncLogger
+    {
+    public:
+        AsyncLogger()
+            : m_running(false)
+            , m_sleeping(false)
+            , m_stopRequested(false)
+            , m_policy(EOverflowPolicy::block)
+            , m_queueSize(0)
+            , m_generation(0)
+        {
+            logOutput();    // constructed first so it is still there when we drain at exit
+        }
+        ~AsyncLogger() { stop(); }
+
+        bool isRunning() const { return m_running.load(std::memory_order_acquire); }
+
+        void start(EOverflowPolicy::E policy, int queueSize)
+        {
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (isRunning())
+                return;
+
+            size_t size = 2;
+            while (size < (size_t)queueSize)
+                size <<= 1;
+
+            // read by the logging threads once they see m_running
+            m_policy.store(policy, std::memory_order_relaxed);
+            m_queueSize.store(size, std::memory_order_relaxed);
+            m_generation.fetch_add(1, std::memory_order_relaxed);
+            m_stopRequested = false;
+            m_thread = std::thread(&AsyncLogger::run, this);
+            m_running.store(true, std::memory_order_release);
+        }
+
+        void stop()
+        {
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (!isRunning())
+                return;
+
+            // new messages go the synchronous way from now on, the queued ones are drained;
+            // seq_cst pairs with the fence in push(), which then sees either this or its record drained
+            m_running.store(false, std::memory_order_seq_cst);
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                m_stopRequested = true;
+            }
+            m_wakeUp.notify_one();
+            m_thread.join();
+
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_queues.clear();
+        }
+
+        void push(const char * datetime, const char * level, const char * file, int line, const char * fmt, va_list args)
+        {
+            AsyncLogQueue & queue = threadQueue();
+            AsyncLogRecord * rec = beginPush(queue);
+            if (!rec)
+                return;
+
+            if (datetime)
+                strncpy(rec->datetime, datetime, DATETIME_BUF_LEN - 1);
+            rec->datetime[datetime ? DATETIME_BUF_LEN - 1 : 0] = '\0';
+            rec->hasTime = false;
+            rec->level = level;
+            rec->file = file;
+            rec->line = line;
+            rec->fmt = 0;
+
+            const int len = vsnprintf(rec->msg, DA_LOG_ASYNC_MSG_SIZE, fmt, args);
+            if (len >= DA_LOG_ASYNC_MSG_SIZE)
+            {
+                memcpy(rec->msg + DA_LOG_ASYNC_MSG_SIZE - 5, "...\n", 5);
+                rec->msgLen = DA_LOG_ASYNC_MSG_SIZE - 1;
+            }
+            else
+                rec->msgLen = len < 0 ? 0 : len;
+
+            endPush(queue, rec);
+        }
+
+        // The arguments must fit in DA_LOG_ASYNC_MSG_SIZE (see binaryArgsSize()).
+        template<typename... Args>
+        void pushArgs(const LogConfig & config, ELogLevel::E level, const char * file, int line, const char * fmt, const Args &... args)
+        {
+            AsyncLogQueue & queue = threadQueue();
+            AsyncLogRecord * rec = beginPush(queue);
+            if (!rec)
+                return;
+
+            rec->datetime[0] = '\0';
+            rec->hasTime = config.format.datetime;
+            if (rec->hasTime)
+                rec->time = logClockTime(config.clock);
+            rec->level = config.format.logLevel ? ELogLevel::c_str(level) : 0;
+            rec->file = config.format.place ? file : 0;
+            rec->line = line;
+            rec->fmt = fmt;
+            rec->types = BinaryArgTypes<typename std::decay<Args>::type...>::str();
+
+            BinaryBufferWriter w(rec->msg);
+            putBinaryArgs(w, args...);
+            rec->msgLen = w.len;
+
+            endPush(queue, rec);
+        }
+
+        size_t queueCount()
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            return m_queues.size();
+        }
+
+        void flush()
+        {
+            std::vector<std::pair<std::shared_ptr<AsyncLogQueue>, size_t> > targets;
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                for (size_t i = 0; i < m_queues.size(); i++)
+                    targets.push_back(std::make_pair(m_queues[i], m_queues[i]->pushed()));
+            }
+            wakeUp();
+
+            std::unique_lock<std::mutex> locker(m_mutex);
+            for (size_t i = 0; i < targets.size(); i++)
+            {
+                AsyncLogQueue & queue = *targets[i].first;
+                const size_t target = targets[i].second;
+                while (queue.written() < target && !m_stopRequested)
+                    m_flushed.wait_for(locker, std::chrono::milliseconds(10));
+            }
+        }
+
+    private:
+        AsyncLogger(const AsyncLogger &);
+        AsyncLogger & operator=(const AsyncLogger &);
+
+        AsyncLogQueue & threadQueue()
+        {
+            static thread_local std::shared_ptr<AsyncLogQueue> t_queue;
+            const int generation = m_generation.load(std::memory_order_relaxed);
+            if (!t_queue || t_queue->generation() != generation)
+            {
+                t_queue = std::make_shared<AsyncLogQueue>(m_queueSize.load(std::memory_order_relaxed), generation);
+                std::lock_guard<std::mutex> locker(m_mutex);
+                m_queues.push_back(t_queue);
+            }
+            return *t_queue;
+        }
+
+        // Returns a slot to fill and pass to endPush() or 0 if the message is dropped.
+        AsyncLogRecord * beginPush(AsyncLogQueue & queue)
+        {
+            const int policy = m_policy.load(std::memory_order_relaxed);
+            AsyncLogRecord * rec = 0;
+            while (!(rec = queue.beginPush()))
+            {
+                if (policy == EOverflowPolicy::dropNewest)
+                {
+                    queue.dropNewest();
+                    return 0;
+                }
+                if (policy == EOverflowPolicy::dropOldest && queue.dropOldest())
+                    continue;
+                if (!isRunning())
+                {
+                    // stopped meanwhile, nobody else makes room any more
+                    writeQueued(queue);
+                    continue;
+                }
+                wakeUp();
+                std::this_thread::yield();
+            }
+            return rec;
+        }
+
+        void endPush(AsyncLogQueue & queue, AsyncLogRecord * rec)
+        {
+            queue.endPush(rec);
+
+            // pairs with the fence in run(), so either we see it sleeping or it sees our record
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_sleeping.load(std::memory_order_relaxed))
+                wakeUp();
+
+            // stop() may have drained for the last time before the record was queued
+            if (!isRunning())
+                writeQueued(queue);
+        }
+
+        // args is scratch space for decoding captured arguments
+        static void appendRecord(LogLine & out, const AsyncLogRecord & rec, std::vector<BinaryArgValue> & args)
+        {
+            if (!rec.fmt)
+            {
+                out.appendHeader(rec.datetime[0] ? rec.datetime : 0, rec.level, rec.file, rec.line);
+                out.append(rec.msg, rec.msgLen);
+                return;
+            }
+
+            out.appendHeader(rec.hasTime ? datetimeString(rec.time).s : 0, rec.level, rec.file, rec.line);
+            readBinaryArgValues(rec.types, rec.msg, rec.msgLen, args);
+            const std::string msg = formatBinaryMessage(rec.fmt, args);
+            out.append(msg.data(), msg.size());
+        }
+
+        // Writes synchronously what is left in the calling thread's queue after stop().
+        static void writeQueued(AsyncLogQueue & queue)
+        {
+            LogLine & out = threadLogLine();
+            std::vector<BinaryArgValue> args;
+            size_t pos = 0;
+            while (AsyncLogRecord * rec = queue.beginPop(&pos))
+            {
+                out.clear();
+                appendRecord(out, *rec, args);
+                queue.endPop(rec, pos);
+                writeLog(out.data(), out.size());
+            }
+        }
+
+        void wakeUp()
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_wakeUp.notify_one();
+        }
+
+        // Writes everything queued at the moment, returns true if there was anything.
+        bool drain(std::vector<std::shared_ptr<AsyncLogQueue> > & queues)
+        {
+            bool any = false;
+            size_t dropped = 0;
+            m_doneBeforeWrite.resize(queues.size());
+            for (size_t i = 0; i < queues.size(); i++)
+            {
+                AsyncLogQueue & queue = *queues[i];
+                size_t pos = 0;
+                while (AsyncLogRecord * rec = queue.beginPop(&pos))
+                {
+                    appendRecord(m_out, *rec, m_args);
+                    queue.endPop(rec, pos);
+                    any = true;
+                    if (m_out.size() >= DA_LOG_ASYNC_WRITE_SIZE)
+                        writeOut();
+                }
+                dropped += queue.takeDropped();
+                m_doneBeforeWrite[i] = queue.done();
+            }
+
+            if (dropped)
+            {
+                m_out.appendHeader(datetimeString().s, ELogLevel::c_str(ELogLevel::warn), 0, 0);
+                m_out.append("async logger dropped ");
+                m_out.appendInt(dropped);
+                m_out.append(" messages\n");
+            }
+            writeOut();
+
+            // only now flush() may return for what was popped
+            for (size_t i = 0; i < queues.size(); i++)
+                queues[i]->setWritten(m_doneBeforeWrite[i]);
+            return any;
+        }
+
+        void writeOut()
+        {
+            if (m_out.size())
+                writeLog(m_out.data(), m_out.size());
+            m_out.clear();
+        }
+
+        void run()
+        {
+            std::vector<std::shared_ptr<AsyncLogQueue> > queues;
+            while (true)
+            {
+                // our own copies would keep every use_count() above 1
+                queues.clear();
+                {
+                    std::lock_guard<std::mutex> locker(m_mutex);
+                    // queues of finished threads are only referenced by us, forget them once empty
+                    for (size_t i = 0; i < m_queues.size(); )
+                    {
+                        if (m_queues[i].use_count() == 1 && m_queues[i]->done() == m_queues[i]->pushed())
+                        {
+                            m_queues[i] = m_queues.back();
+                            m_queues.pop_back();
+                        }
+                        else
+                            i++;
+                    }
+                    queues = m_queues;
+                }
+
+                if (drain(queues))
+                {
+                    m_flushed.notify_all();
+                    continue;
+                }
+                m_flushed.notify_all();
+
+                std::unique_lock<std::mutex> locker(m_mutex);
+                if (m_stopRequested)
+                    break;
+
+                m_sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                bool empty = true;
+                for (size_t i = 0; i < m_queues.size() && empty; i++)
+                    empty = m_queues[i]->done() == m_queues[i]->pushed();
+                if (empty)
+                    m_wakeUp.wait_for(locker, std::chrono::milliseconds(100));
+                m_sleeping.store(false, std::memory_order_relaxed);
+            }
+
+            // threads which still log while we stop already go the synchronous way
+            drain(queues);
+            m_flushed.notify_all();
+        }
+
+        std::atomic<bool> m_running;
+        std::atomic<bool> m_sleeping;
+        bool m_stopRequested;           // guarded by m_mutex
+        std::atomic<int> m_policy;      // EOverflowPolicy::E
+        std::atomic<size_t> m_queueSize;
+        std::atomic<int> m_generation;
+
+        std::mutex m_startMutex;        // serializes start() and stop()
+        std::mutex m_mutex;             // guards m_queues and m_stopRequested
+        std::condition_variable m_wakeUp;
+        std::condition_variable m_flushed;
+        std::vector<std::shared_ptr<AsyncLogQueue> > m_queues;
+        std::thread m_thread;
+        LogLine m_out;                  // lines drained so far, used only by the background thread
+        std::vector<size_t> m_doneBeforeWrite;  // per queue, used only by the background thread
+        std::vector<BinaryArgValue> m_args;     // used only by the background thread
+    };
+
+    inline AsyncLogger & asyncLogger()
+    {
+        static AsyncLogger s_logger;
+        return s_logger;
+    }
+
+    inline bool isAsyncLogging()
+    {
+        return asyncLogger().isRunning();
+    }
+
+    inline void logAsync(const char * datetime, const char * level, const char * file, int line, const char * fmt, va_list args)
+    {
+        asyncLogger().push(datetime, level, file, line, fmt, args);
+    }
+
+    // Used by LOGF. The arguments are captured as they are if the background thread runs.
+    template<typename... Args>
+    void logfArgs(const LogConfig & config, ELogLevel::E level, const char * file, int line, const char * fmt, const Args &... args)
+    {
+        if (isAsyncLogging() && binaryArgsSize(args...) <= DA_LOG_ASYNC_MSG_SIZE)
+            asyncLogger().pushArgs(config, level, file, line, fmt, args...);
+        else
+            logfUnchecked(config, level, file, line, fmt, args...);
+    }
+
+    } // namespace detail
+
+/**
+ * Starts the background logging thread. Does nothing if it is already running.
+ *
+ * policy       - What to do when a thread logs faster than the background thread writes.
+ * queueSize    - Number of messages each thread can have queued, rounded up to a power of 2.
+ */
+inline void startAsyncLogging(EOverflowPolicy::E policy, int queueSize)
+{
+    detail::asyncLogger().start(policy, queueSize);
+}
+
+/**
+ * Writes all queued messages, stops the background thread and goes back to
+ * logging synchronously. It is also done automatically at exit.
+ */
+inline void stopAsyncLogging()
+{
+    detail::asyncLogger().stop();
+}
+
+/**
+ * Returns when everything logged before the call (by any thread) is written,
+ * including a pending batch (see setLogBatching()).
+ */
+inline void flushLogs()
+{
+    if (detail::isAsyncLogging())
+        detail::asyncLogger().flush();
+    detail::logOutput().flush();
+}
+
+} // namespace
+
+#endif
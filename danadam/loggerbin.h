@@ -0,0 +1,541 @@
+#ifndef DANADAM_LOGGER_BIN_H_GUARD
+#define DANADAM_LOGGER_BIN_H_GUARD
+
+/*
+ * Binary (deferred formatting) mode for LOGF.
+ *
+ * Enabled by defining DA_LOGF_BINARY before including loggerf.h or by using
+ * LOGB() directly. Every callsite registers its file, line, format string and
+ * argument types once. After da::openBinaryLog() a log call only appends the
+ * callsite id, the level, the raw timestamp and the raw argument bytes to a
+ * per-thread lock-free buffer, which is written to the file by a flusher
+ * thread (or by the logging thread itself when its buffer is full).
+ *
+ * The file is turned back into the usual text format with the da-logdecode
+ * tool (see tools/da-logdecode) or da::decodeBinaryLog(). Lines are decoded in
+ * the order they were written to the file, i.e. grouped per thread between
+ * flushes.
+ *
+ * Only arithmetic, enum, pointer and C string arguments are supported. C
+ * strings are copied, up to DA_LOG_BINARY_MAX_STRING bytes. When no binary log
+ * is open the message is formatted and passed to da::logf() right away.
+ *
+ * Example:
+ *
+ *      #define DA_LOGF_BINARY
+ *      #include "loggerf.h"
+ *
+ *      da::openBinaryLog("/var/log/myprog.dalog");
+ *      TRACEF("Message with arguments: %s - %d", str, i);
+ *
+ *      $ da-logdecode /var/log/myprog.dalog
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "loggercommon.h"
+#include "loggerargs.h"
+
+#ifndef DA_LOG_BINARY_BUFFER_SIZE
+#  define DA_LOG_BINARY_BUFFER_SIZE (64 * 1024)   // per thread, power of 2
+#endif
+
+#define LOGB(level, msg, ...) \
+    !DA_LOG_IS_ON_FMT(level, msg) \
+        ? da::logf_noop() \
+        : ((void)sizeof(da::detail::logf_check(msg, ##__VA_ARGS__)), \
+            da::detail::logBinary( \
+                []() { return da::detail::BinaryCallsite(__FILE__, __LINE__, msg "\n"); }, \
+                level, \
+                ##__VA_ARGS__ \
+            ))
+
+namespace da
+{
+
+inline bool openBinaryLog(const char * path, int flushIntervalMs = 100);
+inline void flushBinaryLog();
+inline void closeBinaryLog();
+inline bool decodeBinaryLog(FILE * in);
+
+    namespace detail
+    {
+
+    static const char BINARY_LOG_MAGIC[] = "DALOGB01";
+    static const char BINARY_TAG_CALLSITE = 'C';
+    static const char BINARY_TAG_LOG = 'L';
+
+    enum EBinaryFormat { binaryDatetime = 1, binaryLevel = 2, binaryPlace = 4 };
+
+    struct BinaryCallsite
+    {
+        BinaryCallsite(const char * file, int line, const char * fmt)
+            : file(file)
+            , line(line)
+            , fmt(fmt)
+        { }
+
+        const char * file;
+        int line;
+        const char * fmt;
+    };
+
+    /**
+     * Byte FIFO with one producer (the owning thread) and one consumer (whoever
+     * holds the binary log mutex). Entries may wrap around the end, the
+     * consumer writes the bytes out in order so they come out contiguous.
+     */
+    class BinaryLogRing
+    {
+    public:
+        BinaryLogRing()
+            : m_data(new char[DA_LOG_BINARY_BUFFER_SIZE])
+            , m_head(0)
+            , m_tail(0)
+        { }
+
+        static size_t capacity() { return DA_LOG_BINARY_BUFFER_SIZE; }
+
+        // --- producer ----------------
+        size_t freeSpace() const
+        {
+            return capacity() - (m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire));
+        }
+        size_t tail() const { return m_tail.load(std::memory_order_relaxed); }
+        void put(size_t & pos, const void * src, size_t len)
+        {
+            const size_t offset = pos & (capacity() - 1);
+            const size_t first = len < capacity() - offset ? len : capacity() - offset;
+            memcpy(m_data.get() + offset, src, first);
+            memcpy(m_data.get(), static_cast<const char *>(src) + first, len - first);
+            pos += len;
+        }
+        void commit(size_t pos) { m_tail.store(pos, std::memory_order_release); }
+
+        // --- consumer ----------------
+        bool isEmpty() const
+        {
+            return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+        }
+        void drainTo(FILE * file)
+        {
+            const size_t head = m_head.load(std::memory_order_relaxed);
+            const size_t tail = m_tail.load(std::memory_order_acquire);
+            const size_t len = tail - head;
+            const size_t offset = head & (capacity() - 1);
+            const size_t first = len < capacity() - offset ? len : capacity() - offset;
+            if (file)
+            {
+                fwrite(m_data.get() + offset, 1, first, file);
+                fwrite(m_data.get(), 1, len - first, file);
+            }
+            m_head.store(tail, std::memory_order_release);
+        }
+
+    private:
+        BinaryLogRing(const BinaryLogRing &);
+        BinaryLogRing & operator=(const BinaryLogRing &);
+
+        std::unique_ptr<char[]> m_data;
+        alignas(64) std::atomic<size_t> m_head;
+        alignas(64) std::atomic<size_t> m_tail;
+    };
+
+    struct BinaryRingWriter
+    {
+        BinaryRingWriter(BinaryLogRing & ring) : ring(ring), pos(ring.tail()) { }
+        void put(const void * src, size_t len) { ring.put(pos, src, len); }
+
+        BinaryLogRing & ring;
+        size_t pos;
+    };
+
+    // --- writer ----------------
+
+    class BinaryLog
+    {
+    public:
+        BinaryLog()
+            : m_file(0)
+            , m_open(false)
+            , m_stopRequested(false)
+        { }
+        ~BinaryLog() { close(); }
+
+        bool isOpen() const { return m_open.load(std::memory_order_acquire); }
+
+        bool open(const char * path, int flushIntervalMs)
+        {
+            close();
+
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_file = fopen(path, "wb");
+            if (!m_file)
+                return false;
+
+            fwrite(BINARY_LOG_MAGIC, 1, sizeof(BINARY_LOG_MAGIC) - 1, m_file);
+            for (size_t i = 0; i < m_callsites.size(); i++)
+                fwrite(m_callsites[i].data(), 1, m_callsites[i].size(), m_file);
+
+            m_stopRequested = false;
+            m_flusher = std::thread(&BinaryLog::runFlusher, this, flushIntervalMs);
+            m_open.store(true, std::memory_order_release);
+            return true;
+        }
+
+        void close()
+        {
+            if (!isOpen())
+                return;
+
+            m_open.store(false, std::memory_order_release);
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                m_stopRequested = true;
+            }
+            m_wakeUp.notify_one();
+            m_flusher.join();
+
+            std::lock_guard<std::mutex> locker(m_mutex);
+            drainAll();
+            fclose(m_file);
+            m_file = 0;
+        }
+
+        void flush()
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            drainAll();
+            if (m_file)
+                fflush(m_file);
+        }
+
+        // for a crash handler: never blocks, gives up if the log or the file is locked
+        bool flushFromSignal()
+        {
+            if (!isOpen() || !m_mutex.try_lock())
+                return false;
+            // the FILE lock is recursive, so fwrite() and fflush() below don't block
+            const bool fileLocked = m_file && ftrylockfile(m_file) == 0;
+            if (fileLocked)
+            {
+                // not drainAll(), that may free rings
+                for (size_t i = 0; i < m_rings.size(); i++)
+                    m_rings[i]->drainTo(m_file);
+                fflush(m_file);
+                funlockfile(m_file);
+            }
+            m_mutex.unlock();
+            return fileLocked;
+        }
+
+        uint32_t registerCallsite(const BinaryCallsite & callsite, const char * types)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            const uint32_t id = m_callsites.size();
+            const uint32_t line = callsite.line;
+            const uint16_t fileLen = strlen(callsite.file);
+            const uint16_t fmtLen = strlen(callsite.fmt);
+            const uint8_t typesLen = strlen(types);
+
+            std::string rec;
+            rec += BINARY_TAG_CALLSITE;
+            rec.append(reinterpret_cast<const char *>(&id), sizeof(id));
+            rec.append(reinterpret_cast<const char *>(&line), sizeof(line));
+            rec.append(reinterpret_cast<const char *>(&fileLen), sizeof(fileLen));
+            rec.append(callsite.file, fileLen);
+            rec.append(reinterpret_cast<const char *>(&fmtLen), sizeof(fmtLen));
+            rec.append(callsite.fmt, fmtLen);
+            rec.append(reinterpret_cast<const char *>(&typesLen), sizeof(typesLen));
+            rec.append(types, typesLen);
+            m_callsites.push_back(rec);
+
+            if (m_file)
+                fwrite(rec.data(), 1, rec.size(), m_file);
+            return id;
+        }
+
+        BinaryLogRing & threadRing()
+        {
+            static thread_local std::shared_ptr<BinaryLogRing> t_ring;
+            if (!t_ring)
+            {
+                t_ring = std::make_shared<BinaryLogRing>();
+                std::lock_guard<std::mutex> locker(m_mutex);
+                m_rings.push_back(t_ring);
+            }
+            return *t_ring;
+        }
+
+        // Called by the producer when its ring is full.
+        void makeRoom(BinaryLogRing & ring)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            ring.drainTo(m_file);
+        }
+
+    private:
+        BinaryLog(const BinaryLog &);
+        BinaryLog & operator=(const BinaryLog &);
+
+        // requires m_mutex
+        void drainAll()
+        {
+            for (size_t i = 0; i < m_rings.size(); )
+            {
+                m_rings[i]->drainTo(m_file);
+                // rings of finished threads are only referenced by us
+                if (m_rings[i].use_count() == 1 && m_rings[i]->isEmpty())
+                {
+                    m_rings[i] = m_rings.back();
+                    m_rings.pop_back();
+                }
+                else
+                    i++;
+            }
+        }
+
+        void runFlusher(int flushIntervalMs)
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            while (!m_stopRequested)
+            {
+                m_wakeUp.wait_for(locker, std::chrono::milliseconds(flushIntervalMs));
+                drainAll();
+                fflush(m_file);
+            }
+        }
+
+        std::mutex m_mutex;             // guards everything below
+        FILE * m_file;
+        std::atomic<bool> m_open;
+        bool m_stopRequested;
+        std::condition_variable m_wakeUp;
+        std::thread m_flusher;
+        std::vector<std::string> m_callsites;   // serialized, to repeat them when a new file is opened
+        std::vector<std::shared_ptr<BinaryLogRing> > m_rings;
+    };
+
+    inline BinaryLog & binaryLog()
+    {
+        static BinaryLog s_log;
+        return s_log;
+    }
+
+    template<typename CallsiteFn, typename... Args>
+    void logBinary(CallsiteFn callsite, ELogLevel::E level, const Args &... args)
+    {
+        // CallsiteFn is a lambda, so a distinct type (and a distinct static) for every callsite
+        static const uint32_t s_id = binaryLog().registerCallsite(
+                callsite(),
+                BinaryArgTypes<typename std::decay<Args>::type...>::str()
+            );
+
+        const LogConfig & config = logConfig();
+        const LogFormat & format = config.format;
+        BinaryLog & log = binaryLog();
+        if (!log.isOpen())
+        {
+            const BinaryCallsite site = callsite();
+            std::vector<BinaryArgValue> values;
+            binaryArgValues(values, args...);
+            logf(
+                    format.datetime ? datetimeString(config.clock).s : 0,
+                    format.logLevel ? ELogLevel::c_str(level) : 0,
+                    format.place ? site.file : 0,
+                    site.line,
+                    "%s",
+                    formatBinaryMessage(site.fmt, values).c_str()
+                );
+            return;
+        }
+
+        const uint8_t levelByte = level;
+        const uint8_t formatByte =
+            (format.datetime ? binaryDatetime : 0)
+            | (format.logLevel ? binaryLevel : 0)
+            | (format.place ? binaryPlace : 0);
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        const uint64_t timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+        const size_t size = 1 + sizeof(s_id) + 2 + sizeof(timestamp) + binaryArgsSize(args...);
+        BinaryLogRing & ring = log.threadRing();
+        if (size > ring.capacity())
+            return;
+        if (ring.freeSpace() < size)
+            log.makeRoom(ring);
+
+        BinaryRingWriter w(ring);
+        w.put(&BINARY_TAG_LOG, 1);
+        w.put(&s_id, sizeof(s_id));
+        w.put(&levelByte, 1);
+        w.put(&formatByte, 1);
+        w.put(&timestamp, sizeof(timestamp));
+        putBinaryArgs(w, args...);
+        ring.commit(w.pos);
+    }
+
+    // --- decoder ----------------
+
+    inline bool readBinary(FILE * in, void * dst, size_t len)
+    {
+        return fread(dst, 1, len, in) == len;
+    }
+
+    struct DecodedCallsite
+    {
+        std::string file;
+        uint32_t line;
+        std::string fmt;
+        std::string types;
+    };
+
+    } // namespace detail
+
+/**
+ * Opens (truncates) the binary log file and starts a thread which writes
+ * buffered messages to it every flushIntervalMs milliseconds. Returns false if
+ * the file can't be opened.
+ */
+inline bool openBinaryLog(const char * path, int flushIntervalMs)
+{
+    return detail::binaryLog().open(path, flushIntervalMs);
+}
+
+/**
+ * Writes messages buffered by all threads to the binary log file.
+ */
+inline void flushBinaryLog()
+{
+    detail::binaryLog().flush();
+}
+
+/**
+ * Writes all buffered messages and closes the binary log file. LOGF goes back
+ * to formatting right away. It is also done automatically at exit.
+ */
+inline void closeBinaryLog()
+{
+    detail::binaryLog().close();
+}
+
+/**
+ * Decodes a binary log file written by openBinaryLog() and prints it to
+ * stdout in the same format da::logf() uses. Returns false if the input is not
+ * a binary log or is truncated.
+ */
+inline bool decodeBinaryLog(FILE * in)
+{
+    using namespace detail;
+
+    char magic[sizeof(BINARY_LOG_MAGIC) - 1];
+    if (!readBinary(in, magic, sizeof(magic)) || memcmp(magic, BINARY_LOG_MAGIC, sizeof(magic)) != 0)
+        return false;
+
+    std::vector<DecodedCallsite> callsites;
+    std::vector<BinaryArgValue> args;
+    char tag;
+    while (readBinary(in, &tag, 1))
+    {
+        if (tag == BINARY_TAG_CALLSITE)
+        {
+            uint32_t id;
+            uint16_t len;
+            uint8_t typesLen;
+            DecodedCallsite callsite;
+            if (!readBinary(in, &id, sizeof(id)) || !readBinary(in, &callsite.line, sizeof(callsite.line)))
+                return false;
+            if (!readBinary(in, &len, sizeof(len)))
+                return false;
+            callsite.file.resize(len);
+            if (len && !readBinary(in, &callsite.file[0], len))
+                return false;
+            if (!readBinary(in, &len, sizeof(len)))
+                return false;
+            callsite.fmt.resize(len);
+            if (len && !readBinary(in, &callsite.fmt[0], len))
+                return false;
+            if (!readBinary(in, &typesLen, sizeof(typesLen)))
+                return false;
+            callsite.types.resize(typesLen);
+            if (typesLen && !readBinary(in, &callsite.types[0], typesLen))
+                return false;
+            if (callsites.size() <= id)
+                callsites.resize(id + 1);
+            callsites[id] = callsite;
+        }
+        else if (tag == BINARY_TAG_LOG)
+        {
+            uint32_t id;
+            uint8_t level;
+            uint8_t format;
+            uint64_t timestamp;
+            if (!readBinary(in, &id, sizeof(id)) || id >= callsites.size())
+                return false;
+            if (!readBinary(in, &level, 1) || !readBinary(in, &format, 1))
+                return false;
+            if (!readBinary(in, &timestamp, sizeof(timestamp)))
+                return false;
+
+            const DecodedCallsite & callsite = callsites[id];
+            args.assign(callsite.types.size(), BinaryArgValue());
+            for (size_t i = 0; i < callsite.types.size(); i++)
+            {
+                BinaryArgValue & arg = args[i];
+                arg.type = callsite.types[i];
+                if (arg.type == 's')
+                {
+                    uint32_t len;
+                    if (!readBinary(in, &len, sizeof(len)))
+                        return false;
+                    arg.isNull = len == BINARY_NULL_STRING;
+                    if (!arg.isNull)
+                    {
+                        arg.s.resize(len);
+                        if (len && !readBinary(in, &arg.s[0], len))
+                            return false;
+                    }
+                }
+                else if (!readBinary(in, &arg.v, sizeof(arg.v)))
+                    return false;
+            }
+
+            struct timeval tv;
+            tv.tv_sec = timestamp / 1000000000ULL;
+            tv.tv_usec = (timestamp % 1000000000ULL) / 1000;
+            const std::string msg = formatBinaryMessage(callsite.fmt.c_str(), args);
+            LogLine & out = threadLogLine();
+            out.clear();
+            out.appendHeader(
+                    (format & binaryDatetime) ? datetimeString(tv).s : 0,
+                    (format & binaryLevel) ? ELogLevel::c_str((ELogLevel::E)level) : 0,
+                    (format & binaryPlace) ? callsite.file.c_str() : 0,
+                    callsite.line
+                );
+            out.append(msg.data(), msg.size());
+            writeLog(out.data(), out.size());
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef DANADAM_LOGGER_CALLSITE_H_GUARD
+#define DANADAM_LOGGER_CALLSITE_H_GUARD
+
+/*
+ * Per-callsite log filtering.
+ *
+ * Every log macro expansion owns a static da::LogCallsite with its file, line
+ * and format. A descriptor registers itself the first time it is checked,
+ * in one registry shared by the executable and the shared libraries, so a
+ * new config resets the callsites of all of them.
+ *
+ * The descriptor caches the lowest level logged at that callsite, so the
+ * check is a single relaxed load. The level comes from the last matching rule
+ * of the config (see da::setLogRules() in loggerconfig.h) or, if no rule
+ * matches, from its log level. Publishing a new config just resets the caches;
+ * each callsite works its level out again the next time it is reached.
+ *
+ * A rule glob ("*" and "?") has to match the whole __FILE__ or a part of it
+ * starting after a '/'.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+// the static descriptor of the callsite where it is expanded
+#define DA_LOG_CALLSITE(fmt) \
+    ([]() -> da::LogCallsite & { \
+        static da::LogCallsite s_daLogCallsite(__FILE__, __LINE__, fmt); \
+        return s_daLogCallsite; \
+    }())
+
+namespace da
+{
+
+class LogCallsite
+{
+public:
+    static const int unresolved = -1;
+
+    constexpr LogCallsite(const char * file, int line, const char * fmt)
+        : m_file(file)
+        , m_line(line)
+        , m_fmt(fmt)
+        , m_level(unresolved)
+        , m_registered(false)
+    { }
+
+    const char * file() const { return m_file; }
+    int line() const { return m_line; }
+    const char * fmt() const { return m_fmt; }     // 0 for the Qt macros
+
+    bool isOn(int level)
+    {
+        int minLevel = m_level.load(std::memory_order_relaxed);
+        if (minLevel == unresolved)
+            minLevel = resolve();
+        return level >= minLevel;
+    }
+
+    void reset() { m_level.store(unresolved, std::memory_order_relaxed); }
+
+private:
+    inline int resolve();
+
+    const char * const m_file;
+    const int m_line;
+    const char * const m_fmt;
+    std::atomic<signed char> m_level;
+    bool m_registered;                  // guarded by the registry mutex
+};
+
+    namespace detail
+    {
+
+    struct LogCallsiteRegistry
+    {
+        std::mutex mutex;                       // also serializes publishing of the config
+        std::vector<LogCallsite *> callsites;   // the ones checked so far
+    };
+
+    inline LogCallsiteRegistry & logCallsiteRegistry()
+    {
+        static LogCallsiteRegistry s_registry;
+        return s_registry;
+    }
+
+    // "*" matches any run of characters (including '/'), "?" any single one
+    inline bool globMatch(const char * glob, const char * s)
+    {
+        const char * star = 0;
+        const char * starS = 0;
+        while (*s)
+        {
+            if (*glob == '*')
+            {
+                star = glob++;
+                starS = s;
+            }
+            else if (*glob == '?' || *glob == *s)
+            {
+                glob++;
+                s++;
+            }
+            else if (star)
+            {
+                glob = star + 1;
+                s = ++starS;
+            }
+            else
+                return false;
+        }
+        while (*glob == '*')
+            glob++;
+        return *glob == '\0';
+    }
+
+    inline bool fileMatches(const std::string & glob, const char * file)
+    {
+        if (globMatch(glob.c_str(), file))
+            return true;
+        for (const char * slash = strchr(file, '/'); slash; slash = strchr(slash + 1, '/'))
+        {
+            if (globMatch(glob.c_str(), slash + 1))
+                return true;
+        }
+        return false;
+    }
+
+    // registry.mutex must be locked
+    inline void resetLogCallsites(LogCallsiteRegistry & registry)
+    {
+        for (size_t i = 0; i < registry.callsites.size(); i++)
+            registry.callsites[i]->reset();
+    }
+
+    } // namespace detail
+
+int LogCallsite::resolve()
+{
+    detail::LogCallsiteRegistry & registry = detail::logCallsiteRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+    // a callsite not checked yet has no level to reset
+    if (!m_registered)
+    {
+        registry.callsites.push_back(this);
+        m_registered = true;
+    }
+
+    // a new config is published before the callsites are reset under the same lock, so this is not stale
+    const LogConfig & config = logConfig();
+    int level = config.logLevel;
+    for (size_t i = 0; i < config.rules.size(); i++)
+    {
+        const detail::LogRule & rule = config.rules[i];
+        if ((rule.line == 0 || rule.line == m_line) && detail::fileMatches(rule.glob, m_file))
+            level = rule.level;
+    }
+    m_level.store(level, std::memory_order_relaxed);
+    return level;
+}
+
+} // namespace
+
+#endif
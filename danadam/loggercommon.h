@@ -1,15 +1,49 @@
 #ifndef LOGGER_COMMON_H_GUARD
 #define LOGGER_COMMON_H_GUARD
 
+/*
+ * Compile time log level floor. Log calls with a constant level below
+ * DA_LOG_MIN_LEVEL (e.g. TRACEF with -DDA_LOG_MIN_LEVEL=DA_LOG_LEVEL_INFO)
+ * compile to nothing: the arguments are not evaluated and neither the message
+ * nor __FILE__ end up in the binary. DA_LOG_LEVEL_OFF removes all of them.
+ * The runtime level (da::setLogLevel(), da::setLogRules()) still applies to
+ * the remaining calls.
+ */
+#define DA_LOG_LEVEL_TRACE 0
+#define DA_LOG_LEVEL_INFO  1
+#define DA_LOG_LEVEL_WARN  2
+#define DA_LOG_LEVEL_ERROR 3
+#define DA_LOG_LEVEL_OFF   4
+
+#ifndef DA_LOG_MIN_LEVEL
+#  define DA_LOG_MIN_LEVEL DA_LOG_LEVEL_TRACE
+#endif
+
+// for a constant level below the floor this is a constant false, so the compiler drops the call
+#define DA_LOG_IS_ON(level) DA_LOG_IS_ON_FMT(level, 0)
+#define DA_LOG_IS_ON_FMT(level, fmt) \
+    ((level) >= DA_LOG_MIN_LEVEL && DA_LOG_CALLSITE(fmt).isOn(level))
+
+// nothing to define anymore (see loggerconfig.h), kept so the existing INIT_LOGGER(); lines compile
 #define INIT_LOGGER() \
-    da::LogOptions da::g_logOptions = { da::ELogLevel::trace, true, true, true }
+    static_assert(true, "")
+
+#include <string>
+#include <vector>
 
 namespace da
 {
 
 struct ELogLevel
 {
-    enum E { trace, info, warn, error };
+    enum E
+    {
+        trace = DA_LOG_LEVEL_TRACE,
+        info  = DA_LOG_LEVEL_INFO,
+        warn  = DA_LOG_LEVEL_WARN,
+        error = DA_LOG_LEVEL_ERROR,
+        off   = DA_LOG_LEVEL_OFF        // only as a log level setting: nothing is logged
+    };
     static inline const char * c_str(E e);
 };
 
@@ -20,22 +54,47 @@ struct LogFormat
     bool place;
 };
 
-struct LogOptions
+/**
+ * Source of the datetime in the log header. "coarse" uses
+ * CLOCK_REALTIME_COARSE, which is cheaper but only as precise as the kernel
+ * tick (1-4 ms usually). Where it is not available it is the same as
+ * "precise".
+ */
+struct ELogClock
 {
-    ELogLevel::E logLevel;
-    LogFormat format;
+    enum E { precise, coarse };
 };
 
-extern LogOptions g_logOptions;
+    namespace detail
+    {
+
+    struct LogRule
+    {
+        std::string glob;
+        int line;       // 0 for all lines
+        int level;
+    };
 
-void setLogLevel(da::ELogLevel::E logLevel) { g_logOptions.logLevel = logLevel; }
+    } // namespace detail
 
-inline void setLogFormat(bool datetime, bool logLevel, bool place)
+/**
+ * Everything which affects logging at runtime. A snapshot is never modified,
+ * the setters publish a new one (see loggerconfig.h).
+ */
+struct LogConfig
 {
-    g_logOptions.format.datetime = datetime;
-    g_logOptions.format.logLevel = logLevel;
-    g_logOptions.format.place = place;
-}
+    ELogLevel::E logLevel;
+    LogFormat format;
+    ELogClock::E clock;
+    std::vector<detail::LogRule> rules;     // per-module levels, see da::setLogRules()
+};
+
+// the current snapshot, a single acquire load
+inline const LogConfig & logConfig();
+
+inline void setLogLevel(da::ELogLevel::E logLevel);
+inline void setLogFormat(bool datetime, bool logLevel, bool place);
+inline void setLogClock(ELogClock::E clock);
 
 } // namespace
 
@@ -67,17 +126,59 @@ inline void setLogFormat(bool datetime, bool logLevel, bool place)
 #  include <sys/time.h> // gettimeofday
 #endif
 
+#include <algorithm>
+#include <string>
+
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>     // localtime_r
 
+#include "itoa.h"
+
+#ifndef DA_LOG_LINE_SIZE
+#  define DA_LOG_LINE_SIZE 1024     // initial per thread line buffer, grows when needed
+#endif
+
 namespace da
 {
 
 static const int DATETIME_BUF_LEN = 24;
 struct DateTimeString { char s[DATETIME_BUF_LEN]; };
 
+    namespace detail
+    {
+
+    struct DateTimeCache
+    {
+        time_t sec;         // second for which "dt" was built
+        int msecPos;        // where the milliseconds go in "dt"
+        DateTimeString dt;
+    };
+
+    } // namespace detail
+
 inline DateTimeString datetimeString();
+inline DateTimeString datetimeString(ELogClock::E clock);
+inline DateTimeString datetimeString(const struct timeval & tv);
+
+    namespace detail
+    {
+
+    // never defined, only used in unevaluated context to get printf format checking
+    inline int logf_check(const char * fmt, ...)
+#if defined(_MSC_VER)
+        ;
+#else
+        __attribute__ ((format (printf, 1, 2)));
+#endif
+
+    // defined in loggerasync.h
+    inline bool isAsyncLogging();
+    inline void logAsync(const char * datetime, const char * level, const char * file, int line, const char * fmt, va_list args);
+
+    } // namespace detail
 
 const char * ELogLevel::c_str(E e)
 {
@@ -87,72 +188,268 @@ const char * ELogLevel::c_str(E e)
         case info:  return "INFO";
         case warn:  return "WARN";
         case error: return "ERROR";
+        case off:   return "OFF";
     }
     return "???";
 }
 
-inline DateTimeString datetimeString()
+/*
+ * localtime_r() and the snprintf() are done only when the second changes,
+ * otherwise just the milliseconds are patched into a per-thread copy of the
+ * previous result.
+ */
+inline DateTimeString datetimeString(const struct timeval & tv)
 {
-    struct timeval tv;
-    struct timezone tz;
-    gettimeofday(&tv,&tz);
-
-    // Change data to normal format
-    struct tm f;
-    time_t sec = tv.tv_sec;
-    localtime_r(&sec, &f);
-
-    DateTimeString dt;
-    snprintf(dt.s, DATETIME_BUF_LEN, "%04d-%02d-%02d %02d:%02d:%02d,%03d",
-            (f.tm_year + 1900), (f.tm_mon + 1), f.tm_mday,
-            f.tm_hour, f.tm_min, f.tm_sec, (int)(tv.tv_usec / 1000)
-        );
+    static thread_local detail::DateTimeCache t_cache = { (time_t)-1, 0, { { 0 } } };
+
+    if (tv.tv_sec != t_cache.sec)
+    {
+        // Change data to normal format
+        struct tm f;
+        time_t sec = tv.tv_sec;
+        localtime_r(&sec, &f);
+
+        const int len = snprintf(t_cache.dt.s, DATETIME_BUF_LEN, "%04d-%02d-%02d %02d:%02d:%02d,000",
+                (f.tm_year + 1900), (f.tm_mon + 1), f.tm_mday,
+                f.tm_hour, f.tm_min, f.tm_sec
+            );
+        t_cache.msecPos = (len < DATETIME_BUF_LEN ? len : DATETIME_BUF_LEN - 1) - 3;
+        t_cache.sec = tv.tv_sec;
+    }
+
+    DateTimeString dt = t_cache.dt;
+    const int msec = (int)(tv.tv_usec / 1000);
+    char * const ms = dt.s + t_cache.msecPos;
+    ms[0] = '0' + msec / 100;
+    ms[1] = '0' + msec / 10 % 10;
+    ms[2] = '0' + msec % 10;
     return dt;
 }
 
+inline DateTimeString datetimeString()
+{
+    return datetimeString(logConfig().clock);
+}
+
+    namespace detail
+    {
+
+    inline struct timeval logClockTime(ELogClock::E clock)
+    {
+        struct timeval tv;
+#if defined(CLOCK_REALTIME_COARSE)
+        if (clock == ELogClock::coarse)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            tv.tv_sec = ts.tv_sec;
+            tv.tv_usec = ts.tv_nsec / 1000;
+            return tv;
+        }
+#else
+        (void)clock;
+#endif
+        struct timezone tz;
+        gettimeofday(&tv,&tz);
+        return tv;
+    }
+
+    } // namespace detail
+
+inline DateTimeString datetimeString(ELogClock::E clock)
+{
+    return datetimeString(detail::logClockTime(clock));
+}
+
 inline void logf_noop() { }
 inline void logf(const char * datetime, const char * level, const char * file, int line, const char * fmt, ...)
 #if defined(_MSC_VER)
     ;
 #else
 __attribute__ ((format (printf, 5, 6)));
+#endif
+// formats the header according to the config
+inline void logf(const LogConfig & config, ELogLevel::E level, const char * file, int line, const char * fmt, ...)
+#if defined(_MSC_VER)
+    ;
+#else
+__attribute__ ((format (printf, 5, 6)));
 #endif
 
-inline void logf(const char * datetime, const char * level, const char * file, int line, const char * fmt, ...)
-{
-#define SAFE_STR(s) s ? s : ""
-#define SAFE_SEP(s) s ? " " : ""
-
-    if (file)
-    {
-        printf(
-                "%s%s%s%s(%s:%d) - ",
-                SAFE_STR(datetime),
-                SAFE_SEP(datetime),
-                SAFE_STR(level),
-                SAFE_SEP(level),
-                file,
-                line
-            );
+    namespace detail
+    {
+
+    /**
+     * One log line being assembled, so it can be emitted with a single write.
+     * Each thread reuses its own (threadLogLine()), so after the first few
+     * lines there are no allocations.
+     */
+    class LogLine
+    {
+    public:
+        LogLine() : m_buf(DA_LOG_LINE_SIZE, '\0'), m_len(0) { }
+
+        void clear() { m_len = 0; }
+        void truncate(size_t len) { m_len = len; }
+        const char * data() const { return m_buf.data(); }
+        size_t size() const { return m_len; }
+
+        void append(const char * s, size_t len)
+        {
+            reserve(len);
+            memcpy(&m_buf[m_len], s, len);
+            m_len += len;
+        }
+        void append(const char * s) { append(s, strlen(s)); }
+
+        void appendInt(int64_t n)
+        {
+            reserve(21);
+            m_len += itoa(n, &m_buf[m_len], 21);
+        }
+
+        void appendUInt(uint64_t n)
+        {
+            char buf[20];
+            int pos = sizeof(buf);
+            do
+            {
+                buf[--pos] = '0' + n % 10;
+                n /= 10;
+            } while (n > 0);
+            append(buf + pos, sizeof(buf) - pos);
+        }
+
+        void appendf(const char * fmt, ...)
+#if !defined(_MSC_VER)
+            __attribute__ ((format (printf, 2, 3)))
+#endif
+        {
+            va_list args;
+            va_start(args, fmt);
+            appendv(fmt, args);
+            va_end(args);
+        }
+
+        void appendv(const char * fmt, va_list args)
+        {
+            va_list copy;
+            va_copy(copy, args);
+            const size_t avail = m_buf.size() - m_len;
+            const int len = vsnprintf(&m_buf[m_len], avail, fmt, copy);
+            va_end(copy);
+            if (len < 0)
+                return;
+            if ((size_t)len >= avail)
+            {
+                reserve(len + 1);
+                vsnprintf(&m_buf[m_len], len + 1, fmt, args);
+            }
+            m_len += len;
+        }
+
+        // "<datetime> <level> (<file>:<line>) - ", parts which are 0 are skipped
+        void appendHeader(const char * datetime, const char * level, const char * file, int line)
+        {
+            if (!file && !datetime && !level)
+                return;
+            if (datetime)
+            {
+                append(datetime);
+                append(" ", 1);
+            }
+            if (level)
+            {
+                append(level);
+                append(" ", 1);
+            }
+            if (file)
+            {
+                append("(", 1);
+                append(file);
+                append(":", 1);
+                appendInt(line);
+                append(") ", 2);
+            }
+            append("- ", 2);
+        }
+
+    private:
+        void reserve(size_t len)
+        {
+            if (m_len + len > m_buf.size())
+                m_buf.resize(std::max(m_buf.size() * 2, m_len + len));
+        }
+
+        std::string m_buf;
+        size_t m_len;
+    };
+
+    inline LogLine & threadLogLine()
+    {
+        static thread_local LogLine t_line;
+        return t_line;
+    }
+
+    inline void writeLog(const char * data, size_t len);
+
+    } // namespace detail
+
+    namespace detail
+    {
+
+    inline void logv(const char * datetime, const char * level, const char * file, int line, const char * fmt, va_list args)
+    {
+        if (isAsyncLogging())
+        {
+            logAsync(datetime, level, file, line, fmt, args);
+        }
+        else
+        {
+            LogLine & out = threadLogLine();
+            out.clear();
+            out.appendHeader(datetime, level, file, line);
+            out.appendv(fmt, args);
+            writeLog(out.data(), out.size());
+        }
     }
-    else if (datetime || level)
-    {
-        printf(
-                "%s%s%s%s- ",
-                SAFE_STR(datetime),
-                SAFE_SEP(datetime),
-                SAFE_STR(level),
-                SAFE_SEP(level)
+
+    inline void logv(const LogConfig & config, ELogLevel::E level, const char * file, int line, const char * fmt, va_list args)
+    {
+        logv(
+                config.format.datetime ? datetimeString(config.clock).s : 0,
+                config.format.logLevel ? ELogLevel::c_str(level) : 0,
+                config.format.place ? file : 0,
+                line,
+                fmt,
+                args
             );
+    }
 
+    // logf() without the format attribute, for LOGF which checks the format itself
+    inline void logfUnchecked(const LogConfig & config, ELogLevel::E level, const char * file, int line, const char * fmt, ...)
+    {
+        va_list args;
+        va_start(args, fmt);
+        logv(config, level, file, line, fmt, args);
+        va_end(args);
     }
 
-#undef SAFE_STR
-#undef SAFE_SEP
+    } // namespace detail
 
+inline void logf(const char * datetime, const char * level, const char * file, int line, const char * fmt, ...)
+{
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    detail::logv(datetime, level, file, line, fmt, args);
+    va_end(args);
+}
+
+inline void logf(const LogConfig & config, ELogLevel::E level, const char * file, int line, const char * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    detail::logv(config, level, file, line, fmt, args);
     va_end(args);
 }
 
@@ -206,5 +503,10 @@ struct tm *localtime_r(const time_t * timep, struct tm * result)
 // --------------------------------
 
 
+#include "loggercallsite.h"
+#include "loggeroutput.h"
+#include "loggerasync.h"
+#include "loggerconfig.h"
+
 #endif
 
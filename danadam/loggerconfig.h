@@ -0,0 +1,512 @@
+#ifndef DANADAM_LOGGER_CONFIG_H_GUARD
+#define DANADAM_LOGGER_CONFIG_H_GUARD
+
+/*
+ * Runtime log configuration: level, header format, clock and per-module
+ * rules, see da::LogConfig.
+ *
+ * The config is an immutable snapshot behind an atomic pointer. A log call
+ * reads it with a single acquire load (da::logConfig()) and never waits.
+ * The setters copy the current snapshot, change the copy and publish it, so
+ * a reader sees either the old config or the new one, never a mix.
+ * Snapshots are never freed, a reader may keep its reference for as long as
+ * it likes. A change back to an earlier config publishes that snapshot again,
+ * so only distinct configs take memory.
+ *
+ * A rule is "<file glob>[:<line>]:<level>", the level one of trace, info,
+ * warn, error and off. For files matching the glob (or just the given line of
+ * them) it replaces the log level. The last matching rule wins. The header
+ * format is the same for all files, rules change only the level.
+ *
+ * The config can also be read from a file, and on Linux reloaded whenever the
+ * file changes (inotify). The file has one "key = value" per line:
+ *
+ *      # comments start with '#'
+ *      level = warn
+ *      format = datetime level place       # any of these, or none
+ *      clock = coarse                      # or precise
+ *      net_*.cpp = trace                   # anything else is a rule
+ *      net_socket.cpp:120 = off
+ *
+ * The settings missing in the file keep their current values, the rules are
+ * replaced by those in the file. A file with errors is not applied at all.
+ *
+ * Example:
+ *
+ *      da::setLogRules("net_*.cpp:trace, net_socket.cpp:120:off");
+ *      da::watchLogConfig("/etc/myprog/log.conf");
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#  include <errno.h>
+#  include <poll.h>
+#  include <sys/eventfd.h>
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif
+
+namespace da
+{
+
+inline bool setLogRules(const char * rules);
+inline bool loadLogConfig(const char * path);
+#if defined(__linux__)
+inline bool watchLogConfig(const char * path);
+inline void unwatchLogConfig();
+#endif
+
+    namespace detail
+    {
+
+    // a class template, so the pointer can be defined in a header and is constant initialized
+    template<typename T = void>
+    struct LogConfigHolder
+    {
+        static std::atomic<const LogConfig *> s_current;
+    };
+
+    template<typename T>
+    std::atomic<const LogConfig *> LogConfigHolder<T>::s_current(0);
+
+    // until the first change
+    inline const LogConfig & defaultLogConfig()
+    {
+        static const LogConfig s_default = {
+            ELogLevel::trace, { true, true, true }, ELogClock::precise, std::vector<LogRule>()
+        };
+        return s_default;
+    }
+
+    // all snapshots published so far, guarded by the callsite registry mutex
+    inline std::vector<std::unique_ptr<const LogConfig> > & logConfigSnapshots()
+    {
+        static std::vector<std::unique_ptr<const LogConfig> > s_snapshots;
+        return s_snapshots;
+    }
+
+    inline bool sameLogConfig(const LogConfig & a, const LogConfig & b)
+    {
+        if (a.logLevel != b.logLevel || a.clock != b.clock || a.rules.size() != b.rules.size()
+                || a.format.datetime != b.format.datetime || a.format.logLevel != b.format.logLevel
+                || a.format.place != b.format.place)
+            return false;
+        for (size_t i = 0; i < a.rules.size(); i++)
+        {
+            if (a.rules[i].glob != b.rules[i].glob || a.rules[i].line != b.rules[i].line || a.rules[i].level != b.rules[i].level)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Publishes a copy of the current config changed by "change", or the
+     * same config published before. The callsite registry lock makes the
+     * concurrent changes apply one after another and keeps
+     * LogCallsite::resolve() from caching a level of the old config after
+     * the reset.
+     */
+    template<typename FunT>
+    void updateLogConfig(FunT change)
+    {
+        LogCallsiteRegistry & registry = logCallsiteRegistry();
+        std::lock_guard<std::mutex> locker(registry.mutex);
+        LogConfig changed(logConfig());
+        change(changed);
+
+        std::vector<std::unique_ptr<const LogConfig> > & snapshots = logConfigSnapshots();
+        size_t i = 0;
+        while (i < snapshots.size() && !sameLogConfig(*snapshots[i], changed))
+            i++;
+        if (i == snapshots.size())
+            snapshots.push_back(std::unique_ptr<const LogConfig>(new LogConfig(changed)));
+
+        LogConfigHolder<>::s_current.store(snapshots[i].get(), std::memory_order_release);
+        resetLogCallsites(registry);
+    }
+
+    inline std::string trimmed(const std::string & s)
+    {
+        size_t begin = 0;
+        size_t end = s.size();
+        while (begin < end && isspace((unsigned char)s[begin]))
+            begin++;
+        while (end > begin && isspace((unsigned char)s[end - 1]))
+            end--;
+        return s.substr(begin, end - begin);
+    }
+
+    inline std::string lowercase(std::string s)
+    {
+        for (size_t i = 0; i < s.size(); i++)
+            s[i] = tolower((unsigned char)s[i]);
+        return s;
+    }
+
+    inline int parseLogRuleLevel(const std::string & name)
+    {
+        const std::string lower = lowercase(name);
+        if (lower == "trace") return DA_LOG_LEVEL_TRACE;
+        if (lower == "info")  return DA_LOG_LEVEL_INFO;
+        if (lower == "warn")  return DA_LOG_LEVEL_WARN;
+        if (lower == "error") return DA_LOG_LEVEL_ERROR;
+        if (lower == "off")   return DA_LOG_LEVEL_OFF;
+        return -1;
+    }
+
+    inline bool parseLogRule(const std::string & text, LogRule * rule)
+    {
+        const size_t levelSep = text.rfind(':');
+        if (levelSep == std::string::npos || levelSep == 0)
+            return false;
+        rule->level = parseLogRuleLevel(text.substr(levelSep + 1));
+        if (rule->level < 0)
+            return false;
+
+        rule->glob = text.substr(0, levelSep);
+        rule->line = 0;
+        const size_t lineSep = rule->glob.rfind(':');
+        if (lineSep != std::string::npos)
+        {
+            const std::string line = rule->glob.substr(lineSep + 1);
+            char * end = 0;
+            rule->line = strtol(line.c_str(), &end, 10);
+            if (line.empty() || *end != '\0' || rule->line <= 0)
+                return false;
+            rule->glob.erase(lineSep);
+        }
+        return !rule->glob.empty();
+    }
+
+    // what a config file sets, applied to the current config at once
+    struct LogConfigFile
+    {
+        LogConfigFile() : hasLevel(false), hasFormat(false), hasClock(false) { }
+
+        bool hasLevel;
+        bool hasFormat;
+        bool hasClock;
+        LogConfig values;
+    };
+
+    inline bool parseLogConfigFormat(const std::string & value, LogFormat * format)
+    {
+        LogFormat parsed = { false, false, false };
+        const char * p = value.c_str();
+        while (*p)
+        {
+            const size_t len = strcspn(p, ", \t");
+            const std::string word = lowercase(std::string(p, len));
+            if (word == "datetime")
+                parsed.datetime = true;
+            else if (word == "level")
+                parsed.logLevel = true;
+            else if (word == "place")
+                parsed.place = true;
+            else if (!word.empty() && word != "none")
+                return false;
+            p += len;
+            if (*p)
+                p++;
+        }
+        *format = parsed;
+        return true;
+    }
+
+    inline bool parseLogConfigLine(const std::string & key, const std::string & value, LogConfigFile * file)
+    {
+        const std::string lowerKey = lowercase(key);
+        if (lowerKey == "level")
+        {
+            const int level = parseLogRuleLevel(value);
+            if (level < 0)
+                return false;
+            file->values.logLevel = (ELogLevel::E)level;
+            file->hasLevel = true;
+            return true;
+        }
+        if (lowerKey == "format")
+        {
+            file->hasFormat = true;
+            return parseLogConfigFormat(value, &file->values.format);
+        }
+        if (lowerKey == "clock")
+        {
+            const std::string clock = lowercase(value);
+            file->values.clock = clock == "coarse" ? ELogClock::coarse : ELogClock::precise;
+            file->hasClock = true;
+            return clock == "coarse" || clock == "precise";
+        }
+
+        LogRule rule;
+        if (!parseLogRule(key + ":" + value, &rule))
+            return false;
+        file->values.rules.push_back(rule);
+        return true;
+    }
+
+    inline bool parseLogConfigFile(const std::string & text, LogConfigFile * file)
+    {
+        size_t pos = 0;
+        while (pos < text.size())
+        {
+            size_t end = text.find('\n', pos);
+            if (end == std::string::npos)
+                end = text.size();
+            std::string line = text.substr(pos, end - pos);
+            pos = end + 1;
+
+            const size_t comment = line.find('#');
+            if (comment != std::string::npos)
+                line.erase(comment);
+            line = trimmed(line);
+            if (line.empty())
+                continue;
+
+            const size_t eq = line.find('=');
+            if (eq == std::string::npos)
+                return false;
+            if (!parseLogConfigLine(trimmed(line.substr(0, eq)), trimmed(line.substr(eq + 1)), file))
+                return false;
+        }
+        return true;
+    }
+
+#if defined(__linux__)
+    class LogConfigWatcher
+    {
+    public:
+        LogConfigWatcher()
+            : m_inotifyFd(-1)
+            , m_stopFd(-1)
+        {
+            logOutput();    // constructed first so it is still there when we log at exit
+        }
+        ~LogConfigWatcher() { unwatch(); }
+
+        bool watch(const char * path)
+        {
+            unwatch();
+
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (!loadLogConfig(path))
+                return false;
+
+            m_path = path;
+            const size_t slash = m_path.rfind('/');
+            const std::string dir = slash == std::string::npos ? "." : m_path.substr(0, slash + 1);
+            m_name = slash == std::string::npos ? m_path : m_path.substr(slash + 1);
+
+            // the directory, not the file, so editors which write a new file and rename it work too
+            m_inotifyFd = inotify_init1(IN_CLOEXEC);
+            m_stopFd = eventfd(0, EFD_CLOEXEC);
+            if (m_inotifyFd < 0 || m_stopFd < 0
+                    || inotify_add_watch(m_inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+            {
+                closeFds();
+                return false;
+            }
+            m_thread = std::thread(&LogConfigWatcher::run, this);
+            return true;
+        }
+
+        void unwatch()
+        {
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (!m_thread.joinable())
+                return;
+            const uint64_t one = 1;
+            const ssize_t rc = ::write(m_stopFd, &one, sizeof(one));
+            (void)rc;
+            m_thread.join();
+            closeFds();
+        }
+
+    private:
+        LogConfigWatcher(const LogConfigWatcher &);
+        LogConfigWatcher & operator=(const LogConfigWatcher &);
+
+        void closeFds()
+        {
+            if (m_inotifyFd >= 0)
+                ::close(m_inotifyFd);
+            if (m_stopFd >= 0)
+                ::close(m_stopFd);
+            m_inotifyFd = -1;
+            m_stopFd = -1;
+        }
+
+        void run()
+        {
+            struct pollfd fds[2] = { { m_inotifyFd, POLLIN, 0 }, { m_stopFd, POLLIN, 0 } };
+            alignas(struct inotify_event) char buf[4096];
+            while (true)
+            {
+                if (poll(fds, 2, -1) < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return;
+                }
+                if (fds[1].revents)
+                    return;
+
+                const ssize_t len = ::read(m_inotifyFd, buf, sizeof(buf));
+                if (len < 0 && errno == EINTR)
+                    continue;
+                if (len <= 0)
+                    return;
+
+                bool changed = false;
+                for (const char * p = buf; p < buf + len; )
+                {
+                    const struct inotify_event * event = reinterpret_cast<const struct inotify_event *>(p);
+                    if (event->len && m_name == event->name)
+                        changed = true;
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+                if (changed && !loadLogConfig(m_path.c_str()) && DA_LOG_IS_ON(ELogLevel::warn))
+                {
+                    logf(logConfig(), ELogLevel::warn, __FILE__, __LINE__,
+                            "can't load log config %s, keeping the old one\n", m_path.c_str());
+                }
+            }
+        }
+
+        std::string m_path;             // set before the thread starts, like the fds
+        std::string m_name;
+        int m_inotifyFd;
+        int m_stopFd;
+
+        std::mutex m_startMutex;        // serializes watch() and unwatch()
+        std::thread m_thread;
+    };
+
+    inline LogConfigWatcher & logConfigWatcher()
+    {
+        static LogConfigWatcher s_watcher;
+        return s_watcher;
+    }
+#endif
+
+    } // namespace detail
+
+const LogConfig & logConfig()
+{
+    const LogConfig * config = detail::LogConfigHolder<>::s_current.load(std::memory_order_acquire);
+    return config ? *config : detail::defaultLogConfig();
+}
+
+void setLogLevel(da::ELogLevel::E logLevel)
+{
+    detail::updateLogConfig([=](LogConfig & config) { config.logLevel = logLevel; });
+}
+
+void setLogFormat(bool datetime, bool logLevel, bool place)
+{
+    detail::updateLogConfig([=](LogConfig & config)
+    {
+        config.format.datetime = datetime;
+        config.format.logLevel = logLevel;
+        config.format.place = place;
+    });
+}
+
+void setLogClock(ELogClock::E clock)
+{
+    detail::updateLogConfig([=](LogConfig & config) { config.clock = clock; });
+}
+
+/**
+ * Replaces the rules, "" removes them all. They are separated by commas or
+ * spaces. Returns false (and keeps the old rules) if any of them can't be
+ * parsed.
+ */
+inline bool setLogRules(const char * rules)
+{
+    std::vector<detail::LogRule> parsed;
+    const char * p = rules;
+    while (*p)
+    {
+        const size_t len = strcspn(p, ", \t\n");
+        if (len)
+        {
+            detail::LogRule rule;
+            if (!detail::parseLogRule(std::string(p, len), &rule))
+                return false;
+            parsed.push_back(rule);
+        }
+        p += len;
+        if (*p)
+            p++;
+    }
+
+    detail::updateLogConfig([&](LogConfig & config) { config.rules.swap(parsed); });
+    return true;
+}
+
+/**
+ * Applies the config file at path. Returns false (and changes nothing) if
+ * the file can't be read or has errors.
+ */
+inline bool loadLogConfig(const char * path)
+{
+    FILE * f = fopen(path, "r");
+    if (!f)
+        return false;
+    std::string text;
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, len);
+    fclose(f);
+
+    detail::LogConfigFile file;
+    if (!detail::parseLogConfigFile(text, &file))
+        return false;
+
+    detail::updateLogConfig([&](LogConfig & config)
+    {
+        if (file.hasLevel)
+            config.logLevel = file.values.logLevel;
+        if (file.hasFormat)
+            config.format = file.values.format;
+        if (file.hasClock)
+            config.clock = file.values.clock;
+        config.rules.swap(file.values.rules);
+    });
+    return true;
+}
+
+#if defined(__linux__)
+/**
+ * Applies the config file at path now and again whenever it changes, until
+ * da::unwatchLogConfig(). Only one file is watched, a second call replaces
+ * the first one. Returns false if the file can't be loaded or watched.
+ */
+inline bool watchLogConfig(const char * path)
+{
+    return detail::logConfigWatcher().watch(path);
+}
+
+inline void unwatchLogConfig()
+{
+    detail::logConfigWatcher().unwatch();
+}
+#endif
+
+} // namespace
+
+#endif
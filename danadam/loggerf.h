@@ -1,24 +1,56 @@
 #ifndef LOGGERF_H_GUARD
 #define LOGGERF_H_GUARD
 
-#define TRACEF(msg, ...) LOGF(da::ELogLevel::trace, msg , ##__VA_ARGS__)
-#define INFOF(msg, ...)  LOGF(da::ELogLevel::info,  msg , ##__VA_ARGS__)
-#define WARNF(msg, ...)  LOGF(da::ELogLevel::warn,  msg , ##__VA_ARGS__)
-#define ERRORF(msg, ...) LOGF(da::ELogLevel::error, msg , ##__VA_ARGS__)
-
 #include "loggercommon.h"
 
+#if DA_LOG_MIN_LEVEL <= DA_LOG_LEVEL_TRACE
+#  define TRACEF(msg, ...) LOGF(da::ELogLevel::trace, msg , ##__VA_ARGS__)
+#else
+#  define TRACEF(msg, ...) LOGF_DISCARD(msg , ##__VA_ARGS__)
+#endif
+#if DA_LOG_MIN_LEVEL <= DA_LOG_LEVEL_INFO
+#  define INFOF(msg, ...)  LOGF(da::ELogLevel::info,  msg , ##__VA_ARGS__)
+#else
+#  define INFOF(msg, ...)  LOGF_DISCARD(msg , ##__VA_ARGS__)
+#endif
+#if DA_LOG_MIN_LEVEL <= DA_LOG_LEVEL_WARN
+#  define WARNF(msg, ...)  LOGF(da::ELogLevel::warn,  msg , ##__VA_ARGS__)
+#else
+#  define WARNF(msg, ...)  LOGF_DISCARD(msg , ##__VA_ARGS__)
+#endif
+#if DA_LOG_MIN_LEVEL <= DA_LOG_LEVEL_ERROR
+#  define ERRORF(msg, ...) LOGF(da::ELogLevel::error, msg , ##__VA_ARGS__)
+#else
+#  define ERRORF(msg, ...) LOGF_DISCARD(msg , ##__VA_ARGS__)
+#endif
+
+// below the compile time floor: format is still checked, arguments are not evaluated
+#define LOGF_DISCARD(msg, ...) ((void)sizeof(da::detail::logf_check(msg, ##__VA_ARGS__)))
+
+#if defined(DA_LOGF_BINARY)
+
+#include "loggerbin.h"
+
+#define LOGF(level, msg, ...) LOGB(level, msg, ##__VA_ARGS__)
+
+#else
+
 #define LOGF(level, msg, ...) \
-    (level < da::g_logOptions.logLevel) \
+    !DA_LOG_IS_ON_FMT(level, msg) \
         ? da::logf_noop() \
-        : da::logf( \
-                da::g_logOptions.format.datetime ? da::datetimeString().s : 0, \
-                da::g_logOptions.format.logLevel ? da::ELogLevel::c_str(level) : 0, \
-                da::g_logOptions.format.place ? __FILE__ : 0, \
+        : ((void)sizeof(da::detail::logf_check(msg, ##__VA_ARGS__)), \
+            da::detail::logfArgs( \
+                da::logConfig(), \
+                level, \
+                __FILE__, \
                 __LINE__, \
                 msg "\n", \
                 ##__VA_ARGS__ \
-            )
+            ))
+
+#endif
+
+#include "loggerlimit.h"
 
 #endif
 
@@ -0,0 +1,415 @@
+#ifndef DANADAM_LOGGER_FILE_H_GUARD
+#define DANADAM_LOGGER_FILE_H_GUARD
+
+/*
+ * Memory mapped, rotating log file. After da::openLogFile() the log lines go
+ * to "<path>.000000", "<path>.000001"... instead of stdout.
+ *
+ * Each segment file is preallocated to segmentSize and mapped.
+ * A writer reserves its bytes with an atomic fetch_add and copies the line
+ * in, there is no lock and no syscall. The writer which first doesn't fit
+ * switches to the next segment, which a background thread has already
+ * created and prefaulted. The background thread also unmaps the full
+ * segments once nobody writes to them and truncates the files to what was
+ * written. As the pages belong to the kernel, lines written before a crash
+ * are not lost; the file just ends with zeros then.
+ *
+ * The numbering continues after the segments already on disk. With
+ * keepSegments > 0 only that many full segments are kept (besides the
+ * current one), older ones are removed.
+ *
+ * POSIX only. The preallocation uses fallocate() on Linux, posix_fallocate()
+ * where available and otherwise just ftruncate(). The next segment is
+ * prefaulted (MAP_POPULATE) on Linux only. Elsewhere the first writes to
+ * each page fault it in.
+ *
+ * Example:
+ *
+ *      da::openLogFile("/var/log/myprog.log", 16 * 1024 * 1024, 10);
+ *      TRACEF("goes to /var/log/myprog.log.000000");
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef DA_LOG_FILE_SLOTS
+#  define DA_LOG_FILE_SLOTS 4   // mapped segments at most: current, next one and the retired ones
+#endif
+
+namespace da
+{
+
+inline bool openLogFile(const char * path, size_t segmentSize = 64 * 1024 * 1024, int keepSegments = 0);
+inline void closeLogFile();
+
+    namespace detail
+    {
+
+    struct LogSegment
+    {
+        enum EState { unused, ready, current, retired };
+
+        LogSegment()
+            : state(unused)
+            , fd(-1)
+            , data(0)
+            , size(0)
+            , index(0)
+            , reserved(0)
+            , written(0)
+            , users(0)
+        { }
+
+        EState state;                   // guarded by LogFile::m_mutex, like the fields up to "reserved"
+        int fd;
+        char * data;
+        size_t size;
+        unsigned long index;
+
+        alignas(64) std::atomic<size_t> reserved;
+        std::atomic<size_t> written;
+        alignas(64) std::atomic<int> users;     // writers which may touch "data"
+    };
+
+    class LogFile
+    {
+    public:
+        LogFile()
+            : m_current(0)
+            , m_rotations(0)
+            , m_stopRequested(false)
+            , m_segmentSize(0)
+            , m_keepSegments(0)
+            , m_nextIndex(0)
+        { }
+        ~LogFile() { close(); }
+
+        bool open(const char * path, size_t segmentSize, int keepSegments)
+        {
+            close();
+
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            std::lock_guard<std::mutex> locker(m_mutex);
+            const size_t page = sysconf(_SC_PAGESIZE);
+            m_path = path;
+            m_segmentSize = segmentSize < 16 * page ? 16 * page : (segmentSize + page - 1) / page * page;
+            m_keepSegments = keepSegments;
+            m_nextIndex = firstFreeIndex();
+
+            LogSegment * first = prepare(false);
+            if (!first)
+                return false;
+            first->state = LogSegment::current;
+            m_current.store(first);
+
+            m_stopRequested = false;
+            m_thread = std::thread(&LogFile::run, this);
+            return true;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (!m_thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                if (LogSegment * seg = m_current.exchange(0))
+                    seg->state = LogSegment::retired;
+                m_rotations++;
+                m_stopRequested = true;
+            }
+            m_wakeUp.notify_one();
+            m_thread.join();
+        }
+
+        // Returns false if no file is open, or with mayBlock false if the line needs a rotation.
+        bool write(const char * data, size_t len, bool mayBlock = true)
+        {
+            while (true)
+            {
+                const unsigned long rotations = m_rotations.load();
+                LogSegment * seg = m_current.load();
+                if (!seg)
+                    return false;
+
+                // pairs with retiring: either it sees us in "users" or we see it is not current anymore
+                seg->users.fetch_add(1);
+                if (m_current.load() != seg)
+                {
+                    seg->users.fetch_sub(1);
+                    continue;
+                }
+
+                const size_t size = seg->size;
+                if (len > size)
+                    len = size;         // a line longer than a segment is cut
+                const size_t offset = seg->reserved.fetch_add(len, std::memory_order_relaxed);
+                if (offset + len <= size)
+                {
+                    memcpy(seg->data + offset, data, len);
+                    seg->written.fetch_add(len, std::memory_order_release);
+                    seg->users.fetch_sub(1, std::memory_order_release);
+                    return true;
+                }
+                seg->users.fetch_sub(1, std::memory_order_release);
+
+                if (!mayBlock)
+                    return false;
+                if (offset <= size)
+                    rotate(seg);        // we are the first one which didn't fit
+                else
+                {
+                    // not "while current == seg", the slot may be current again by the time we look
+                    while (m_rotations.load() == rotations)
+                        std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        LogFile(const LogFile &);
+        LogFile & operator=(const LogFile &);
+
+        std::string segmentName(unsigned long index) const
+        {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), ".%06lu", index);
+            return m_path + suffix;
+        }
+
+        // one after the highest numbered segment already on disk
+        unsigned long firstFreeIndex() const
+        {
+            const size_t slash = m_path.rfind('/');
+            const std::string dir = slash == std::string::npos ? "." : m_path.substr(0, slash + 1);
+            const std::string prefix = (slash == std::string::npos ? m_path : m_path.substr(slash + 1)) + ".";
+
+            unsigned long next = 0;
+            DIR * d = opendir(dir.c_str());
+            if (!d)
+                return next;
+            while (struct dirent * entry = readdir(d))
+            {
+                const char * name = entry->d_name;
+                if (strncmp(name, prefix.c_str(), prefix.size()) != 0)
+                    continue;
+                char * end = 0;
+                const unsigned long index = strtoul(name + prefix.size(), &end, 10);
+                if (end != name + prefix.size() && *end == '\0' && index >= next)
+                    next = index + 1;
+            }
+            closedir(d);
+            return next;
+        }
+
+        void rotate(LogSegment * full)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if (m_current.load() != full)
+                return;
+
+            LogSegment * next = 0;
+            for (int i = 0; i < DA_LOG_FILE_SLOTS && !next; i++)
+            {
+                if (m_slots[i].state == LogSegment::ready)
+                    next = &m_slots[i];
+            }
+            if (!next)
+                next = prepare(false);  // the background thread didn't make it in time
+
+            // without a next segment the lines go back to stdout
+            if (next)
+                next->state = LogSegment::current;
+            m_current.store(next);
+            m_rotations++;
+            full->state = LogSegment::retired;
+            m_wakeUp.notify_one();
+        }
+
+        // reserves the blocks where the file system can, otherwise only sets the size
+        static bool preallocate(int fd, size_t size)
+        {
+#if defined(__linux__)
+            if (fallocate(fd, 0, 0, size) == 0)
+                return true;
+#elif defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+            if (posix_fallocate(fd, 0, size) == 0)
+                return true;
+#endif
+            return ftruncate(fd, size) == 0;
+        }
+
+        // m_mutex must be locked
+        LogSegment * prepare(bool prefault)
+        {
+            LogSegment * seg = freeSlot();
+            if (!seg)
+                return 0;
+            const std::string name = segmentName(m_nextIndex);
+            const int fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+                return 0;
+            if (!preallocate(fd, m_segmentSize))
+            {
+                ::close(fd);
+                unlink(name.c_str());
+                return 0;
+            }
+#if defined(__linux__)
+            const int flags = MAP_SHARED | (prefault ? MAP_POPULATE : 0);
+#else
+            const int flags = MAP_SHARED;
+            (void)prefault;
+#endif
+            void * data = mmap(0, m_segmentSize, PROT_READ | PROT_WRITE, flags, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                ::close(fd);
+                unlink(name.c_str());
+                return 0;
+            }
+
+            seg->fd = fd;
+            seg->data = static_cast<char *>(data);
+            seg->size = m_segmentSize;
+            seg->index = m_nextIndex++;
+            seg->reserved.store(0);
+            seg->written.store(0);
+            seg->state = LogSegment::ready;
+            return seg;
+        }
+
+        // m_mutex must be locked
+        LogSegment * freeSlot()
+        {
+            LogSegment * oldest = 0;
+            for (int i = 0; i < DA_LOG_FILE_SLOTS; i++)
+            {
+                LogSegment & seg = m_slots[i];
+                if (seg.state == LogSegment::unused)
+                    return &seg;
+                if (seg.state == LogSegment::retired && (!oldest || seg.index < oldest->index))
+                    oldest = &seg;
+            }
+            // only if the background thread is behind, there is always current, next and one more
+            if (oldest)
+                release(oldest);
+            return oldest;
+        }
+
+        // m_mutex must be locked
+        void release(LogSegment * seg)
+        {
+            while (seg->users.load() != 0)
+                std::this_thread::yield();
+
+            munmap(seg->data, seg->size);
+            if (seg->state == LogSegment::ready)
+                unlink(segmentName(seg->index).c_str());    // never used
+            else
+            {
+                // if it fails the file keeps its trailing zeros, nothing better to do
+                const int rc = ftruncate(seg->fd, seg->written.load(std::memory_order_acquire));
+                (void)rc;
+            }
+            ::close(seg->fd);
+
+            if (seg->state == LogSegment::retired && m_keepSegments > 0 && seg->index >= (unsigned long)m_keepSegments)
+                unlink(segmentName(seg->index - m_keepSegments).c_str());
+            seg->state = LogSegment::unused;
+            seg->data = 0;
+            seg->fd = -1;
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            while (true)
+            {
+                bool haveReady = false;
+                for (int i = 0; i < DA_LOG_FILE_SLOTS; i++)
+                {
+                    if (m_slots[i].state == LogSegment::retired)
+                        release(&m_slots[i]);
+                    haveReady = haveReady || m_slots[i].state == LogSegment::ready;
+                }
+                if (m_stopRequested)
+                    break;
+                if (!haveReady && m_current.load())
+                    prepare(true);
+                m_wakeUp.wait(locker);
+            }
+
+            for (int i = 0; i < DA_LOG_FILE_SLOTS; i++)
+            {
+                if (m_slots[i].state == LogSegment::ready)
+                {
+                    release(&m_slots[i]);
+                    m_nextIndex--;
+                }
+            }
+        }
+
+        std::atomic<LogSegment *> m_current;
+        std::atomic<unsigned long> m_rotations;
+        bool m_stopRequested;           // guarded by m_mutex, like everything below
+        std::string m_path;
+        size_t m_segmentSize;
+        int m_keepSegments;
+        unsigned long m_nextIndex;
+        LogSegment m_slots[DA_LOG_FILE_SLOTS];
+
+        std::mutex m_startMutex;        // serializes open() and close()
+        std::mutex m_mutex;
+        std::condition_variable m_wakeUp;
+        std::thread m_thread;
+    };
+
+    inline LogFile & logFile()
+    {
+        static LogFile s_file;
+        return s_file;
+    }
+
+    } // namespace detail
+
+/**
+ * Sends the log lines to memory mapped segment files instead of stdout. If a
+ * log file is already open, it is closed first. Returns false if the first
+ * segment can't be created.
+ *
+ * path         - Segments are named "<path>.NNNNNN".
+ * segmentSize  - Size of one segment, rounded up to whole pages.
+ * keepSegments - Number of full segments to keep, older ones are removed. 0 keeps all.
+ */
+inline bool openLogFile(const char * path, size_t segmentSize, int keepSegments)
+{
+    return detail::logFile().open(path, segmentSize, keepSegments);
+}
+
+/**
+ * Truncates the current segment to what was written, closes it and goes back
+ * to stdout. It is also done automatically at exit.
+ */
+inline void closeLogFile()
+{
+    detail::logFile().close();
+}
+
+} // namespace
+
+#endif
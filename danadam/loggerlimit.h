@@ -0,0 +1,155 @@
+#ifndef DANADAM_LOGGER_LIMIT_H_GUARD
+#define DANADAM_LOGGER_LIMIT_H_GUARD
+
+/*
+ * Sampled and rate limited variants of LOGF, for log calls in hot loops.
+ *
+ *      LOGF_EVERY_N(level, n, msg, ...)        - 1st, n+1st, 2n+1st... call
+ *      LOGF_FIRST_N(level, n, msg, ...)        - first n calls only
+ *      LOGF_RATE(level, perSecond, msg, ...)   - at most perSecond lines a second,
+ *                                                bursts of up to perSecond lines
+ *
+ * Every callsite has its own static state, on its own cache line. A call
+ * which is not logged costs a relaxed atomic increment (LOGF_RATE also reads
+ * the coarse monotonic clock). LOGF_EVERY_N and LOGF_RATE append
+ * " (N suppressed)" to the next line they do log, when N > 0.
+ *
+ * These are statements, not expressions. The level and the counting are
+ * checked first, so calls below the current log level are not counted.
+ *
+ * Example:
+ *
+ *      for (;;)
+ *          LOGF_RATE(da::ELogLevel::warn, 10, "queue full, dropping %d", id);
+ */
+
+#include <atomic>
+
+#include <stdint.h>
+#include <time.h>
+
+#if !defined(CLOCK_MONOTONIC_COARSE)
+#  include <chrono>
+#endif
+
+#define LOGF_EVERY_N(level, n, msg, ...) \
+    do \
+    { \
+        static da::detail::LogEveryN s_daLogLimit; \
+        uint64_t daSuppressed = 0; \
+        if (DA_LOG_IS_ON(level) && s_daLogLimit.shouldLog(n, &daSuppressed)) \
+            LOGF_SUPPRESSED(level, daSuppressed, msg, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOGF_FIRST_N(level, n, msg, ...) \
+    do \
+    { \
+        static da::detail::LogFirstN s_daLogLimit; \
+        if (DA_LOG_IS_ON(level) && s_daLogLimit.shouldLog(n)) \
+            LOGF(level, msg, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOGF_RATE(level, perSecond, msg, ...) \
+    do \
+    { \
+        static da::detail::LogRate s_daLogLimit; \
+        uint64_t daSuppressed = 0; \
+        if (DA_LOG_IS_ON(level) && s_daLogLimit.shouldLog(perSecond, &daSuppressed)) \
+            LOGF_SUPPRESSED(level, daSuppressed, msg, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOGF_SUPPRESSED(level, suppressed, msg, ...) \
+    (suppressed) \
+        ? LOGF(level, msg " (%llu suppressed)", ##__VA_ARGS__, (unsigned long long)(suppressed)) \
+        : LOGF(level, msg, ##__VA_ARGS__)
+
+namespace da
+{
+
+    namespace detail
+    {
+
+    struct alignas(64) LogEveryN
+    {
+        constexpr LogEveryN() : count(0) { }
+
+        bool shouldLog(uint64_t n, uint64_t * suppressed)
+        {
+            const uint64_t c = count.fetch_add(1, std::memory_order_relaxed);
+            if (n > 1 && c % n != 0)
+                return false;
+            *suppressed = c == 0 || n <= 1 ? 0 : n - 1;
+            return true;
+        }
+
+        std::atomic<uint64_t> count;
+    };
+
+    struct alignas(64) LogFirstN
+    {
+        constexpr LogFirstN() : count(0) { }
+
+        bool shouldLog(uint64_t n)
+        {
+            // no increments once done, so the count can't wrap around
+            if (count.load(std::memory_order_relaxed) >= n)
+                return false;
+            return count.fetch_add(1, std::memory_order_relaxed) < n;
+        }
+
+        std::atomic<uint64_t> count;
+    };
+
+    inline int64_t coarseMonotonicNs()
+    {
+#if defined(CLOCK_MONOTONIC_COARSE)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return 1000000000LL * ts.tv_sec + ts.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /**
+     * Token bucket of perSecond tokens refilled at perSecond a second, kept as
+     * the time at which the bucket is full again ("generic cell rate
+     * algorithm"), so it is a single atomic.
+     */
+    struct alignas(64) LogRate
+    {
+        constexpr LogRate() : fullAt(0), suppressed(0) { }
+
+        bool shouldLog(double perSecond, uint64_t * suppressedOut)
+        {
+            if (perSecond <= 0)
+                return false;
+            const int64_t interval = (int64_t)(1e9 / perSecond);
+            const int64_t burst = perSecond > 1 ? (int64_t)(perSecond * interval) : interval;
+            const int64_t now = coarseMonotonicNs();
+
+            int64_t full = fullAt.load(std::memory_order_relaxed);
+            do
+            {
+                if (full - now >= burst)
+                {
+                    suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            } while (!fullAt.compare_exchange_weak(
+                    full, (full > now ? full : now) + interval, std::memory_order_relaxed));
+
+            *suppressedOut = suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        std::atomic<int64_t> fullAt;
+        std::atomic<uint64_t> suppressed;
+    };
+
+    } // namespace detail
+
+} // namespace
+
+#endif
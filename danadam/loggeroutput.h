@@ -0,0 +1,226 @@
+#ifndef DANADAM_LOGGER_OUTPUT_H_GUARD
+#define DANADAM_LOGGER_OUTPUT_H_GUARD
+
+/*
+ * Where the log lines end up. Every line (da::logf(), the Qt LOG macros, the
+ * async backend, the binary log decoder) is assembled first and handed over
+ * here whole, so lines of different threads never interleave.
+ *
+ * By default each line is written to stdout with one write() call, bypassing
+ * stdio. After da::openLogFile() they are copied into the mapped log file
+ * instead (see loggerfile.h). da::setLogBatching() makes several lines share
+ * a write(): a batch is written when it reaches maxBytes or when its first
+ * line is maxDelayMs old, whichever comes first, and on da::flushLogs() and
+ * at exit.
+ *
+ * Example:
+ *
+ *      da::setLogBatching(64 * 1024, 50);
+ *      TRACEF("written at the latest 50 ms from now");
+ *      da::flushLogs();    // or right now
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <stddef.h>
+#include <stdio.h>
+
+#if defined(_MSC_VER)
+#else
+#  include <errno.h>
+#  include <unistd.h>
+#  include "loggerfile.h"
+#endif
+
+namespace da
+{
+
+inline void setLogBatching(size_t maxBytes, int maxDelayMs = 100);
+
+    namespace detail
+    {
+
+    // with mayBlock false it takes no lock and doesn't rotate the log file, for signal handlers
+    inline void writeAll(const char * data, size_t len, bool mayBlock = true)
+    {
+#if defined(_MSC_VER)
+        (void)mayBlock;
+        fwrite(data, 1, len, stdout);
+        fflush(stdout);
+#else
+        if (logFile().write(data, len, mayBlock))
+            return;
+        while (len > 0)
+        {
+            const ssize_t written = ::write(STDOUT_FILENO, data, len);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            data += written;
+            len -= written;
+        }
+#endif
+    }
+
+    class LogOutput
+    {
+    public:
+        LogOutput()
+            : m_batching(false)
+            , m_maxBytes(0)
+            , m_maxDelayMs(0)
+            , m_stopRequested(false)
+        {
+#if !defined(_MSC_VER)
+            logFile();      // constructed first so it is still there when we flush at exit
+#endif
+        }
+        ~LogOutput() { setBatching(0, 0); }
+
+        void write(const char * data, size_t len)
+        {
+            if (!m_batching.load(std::memory_order_acquire))
+            {
+                writeAll(data, len);
+                return;
+            }
+
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if (m_stopRequested)
+            {
+                // batching was just turned off
+                writeAll(data, len);
+                return;
+            }
+            const bool wasEmpty = m_batch.empty();
+            m_batch.append(data, len);
+            if (m_batch.size() >= m_maxBytes)
+                flushLocked();
+            else if (wasEmpty)
+            {
+                m_batchStart = std::chrono::steady_clock::now();
+                m_wakeUp.notify_one();
+            }
+        }
+
+        void flush()
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            flushLocked();
+        }
+
+        // for a crash handler: never blocks, gives up if the batch is locked
+        bool flushFromSignal()
+        {
+            if (!m_mutex.try_lock())
+                return false;
+            writeAll(m_batch.data(), m_batch.size(), false);
+            m_batch.clear();
+            m_mutex.unlock();
+            return true;
+        }
+
+        void setBatching(size_t maxBytes, int maxDelayMs)
+        {
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (m_thread.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> locker(m_mutex);
+                    m_stopRequested = true;
+                    m_batching.store(false, std::memory_order_release);
+                }
+                m_wakeUp.notify_one();
+                m_thread.join();
+            }
+            if (maxBytes == 0)
+                return;
+
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_maxBytes = maxBytes;
+            m_maxDelayMs = maxDelayMs;
+            m_batch.reserve(maxBytes);
+            m_stopRequested = false;
+            m_thread = std::thread(&LogOutput::run, this);
+            m_batching.store(true, std::memory_order_release);
+        }
+
+    private:
+        LogOutput(const LogOutput &);
+        LogOutput & operator=(const LogOutput &);
+
+        void flushLocked()
+        {
+            writeAll(m_batch.data(), m_batch.size());
+            m_batch.clear();
+        }
+
+        // writes out batches which got old before they got full
+        void run()
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            while (!m_stopRequested)
+            {
+                if (m_batch.empty())
+                {
+                    m_wakeUp.wait(locker);
+                    continue;
+                }
+                const std::chrono::steady_clock::time_point deadline =
+                        m_batchStart + std::chrono::milliseconds(m_maxDelayMs);
+                if (std::chrono::steady_clock::now() >= deadline)
+                    flushLocked();
+                else
+                    m_wakeUp.wait_until(locker, deadline);
+            }
+            flushLocked();
+        }
+
+        std::atomic<bool> m_batching;
+        size_t m_maxBytes;              // guarded by m_mutex, like everything below
+        int m_maxDelayMs;
+        bool m_stopRequested;
+        std::string m_batch;
+        std::chrono::steady_clock::time_point m_batchStart;
+
+        std::mutex m_startMutex;        // serializes setBatching()
+        std::mutex m_mutex;
+        std::condition_variable m_wakeUp;
+        std::thread m_thread;
+    };
+
+    inline LogOutput & logOutput()
+    {
+        static LogOutput s_output;
+        return s_output;
+    }
+
+    inline void writeLog(const char * data, size_t len)
+    {
+        logOutput().write(data, len);
+    }
+
+    } // namespace detail
+
+/**
+ * Turns batching of log lines on or off.
+ *
+ * maxBytes     - Batch is written when it gets this big, 0 writes every line right away (default).
+ * maxDelayMs   - Batch is written at the latest this long after its first line was logged.
+ */
+inline void setLogBatching(size_t maxBytes, int maxDelayMs)
+{
+    detail::logOutput().setBatching(maxBytes, maxDelayMs);
+}
+
+} // namespace
+
+#endif
@@ -1,9 +1,8 @@
 #ifndef LOGGER_QT_H_GUARD
 #define LOGGER_QT_H_GUARD
 
+#include <QByteArray>
 #include <QString>
-#include <QMutex>
-#include <QMutexLocker>
 
 #include "loggercommon.h"
 
@@ -12,50 +11,143 @@
 #define WARN(msg)  LOG(da::ELogLevel::warn)  << QString(msg)
 #define ERROR(msg) LOG(da::ELogLevel::error) << QString(msg)
 
+// The helper, the QString and the .arg() calls are created only if the level is on.
 #define LOG(level) \
-    da::LoggerHelper( \
-            level >= da::g_logOptions.logLevel && da::g_logOptions.format.datetime ? da::datetimeString().s : 0, \
-            level, \
-            __FILE__, \
-            __LINE__ \
-        )
+    !DA_LOG_IS_ON(level) \
+        ? (void)0 \
+        : da::LogVoidify() & da::LoggerHelper( \
+                da::logConfig(), \
+                level, \
+                __FILE__, \
+                __LINE__ \
+            )
 
 namespace da
 {
 
+    namespace detail
+    {
+
+    inline void appendUtf8(LogLine & out, const ushort * s, int len)
+    {
+        for (int i = 0; i < len; i++)
+        {
+            uint32_t c = s[i];
+            if (c >= 0xd800 && c < 0xe000)
+            {
+                if (c < 0xdc00 && i + 1 < len && s[i + 1] >= 0xdc00 && s[i + 1] < 0xe000)
+                    c = 0x10000 + ((c - 0xd800) << 10) + (s[++i] - 0xdc00);
+                else
+                    c = 0xfffd;     // lone surrogate
+            }
+
+            char buf[4];
+            size_t n;
+            if (c < 0x80)
+            {
+                buf[0] = c;
+                n = 1;
+            }
+            else if (c < 0x800)
+            {
+                buf[0] = 0xc0 | (c >> 6);
+                buf[1] = 0x80 | (c & 0x3f);
+                n = 2;
+            }
+            else if (c < 0x10000)
+            {
+                buf[0] = 0xe0 | (c >> 12);
+                buf[1] = 0x80 | ((c >> 6) & 0x3f);
+                buf[2] = 0x80 | (c & 0x3f);
+                n = 3;
+            }
+            else
+            {
+                buf[0] = 0xf0 | (c >> 18);
+                buf[1] = 0x80 | ((c >> 12) & 0x3f);
+                buf[2] = 0x80 | ((c >> 6) & 0x3f);
+                buf[3] = 0x80 | (c & 0x3f);
+                n = 4;
+            }
+            out.append(buf, n);
+        }
+    }
+
+    // separate from threadLogLine(), an argument of LOG() may itself call da::logf()
+    inline LogLine & threadStreamLine()
+    {
+        static thread_local LogLine t_line;
+        return t_line;
+    }
+
+    } // namespace detail
+
+/**
+ * Streams the message straight into a per-thread UTF-8 buffer, the line is
+ * written when the helper goes out of scope. A message is a sequence of
+ * QStrings, QByteArrays (taken as UTF-8), C strings, numbers, chars and bools:
+ *
+ *      LOG(da::ELogLevel::trace) << "took " << ms << " ms for " << name;
+ *
+ * Helpers nested in one thread (a LOG() in a function called to get one of the
+ * arguments) share the buffer, each one uses only the part after where it
+ * started.
+ */
 class LoggerHelper
 {
 public:
-    LoggerHelper(const char * dt, ELogLevel::E level, const char * file, int line)
-        : m_dt(dt)
-        , m_level(level)
-        , m_file(file)
-        , m_line(line)
-    { }
+    LoggerHelper(const LogConfig & config, ELogLevel::E level, const char * file, int line)
+        : m_out(detail::threadStreamLine())
+        , m_start(m_out.size())
+    {
+        m_out.appendHeader(
+                config.format.datetime ? datetimeString(config.clock).s : 0,
+                config.format.logLevel ? ELogLevel::c_str(level) : 0,
+                config.format.place ? file : 0,
+                line
+            );
+    }
     ~LoggerHelper()
     {
-        static QMutex s_mutex;
-        if (m_level >= g_logOptions.logLevel)
-        {
-            QMutexLocker locker(&s_mutex);
-            logf(
-                    m_dt,
-                    da::g_logOptions.format.logLevel ? da::ELogLevel::c_str(m_level) : 0,
-                    da::g_logOptions.format.place ? m_file : 0,
-                    m_line,
-                    "%s\n",
-                    m_msg.toUtf8().data()
-                );
-        }
+        m_out.append("\n", 1);
+        const char * data = m_out.data() + m_start;
+        const size_t len = m_out.size() - m_start;
+        if (detail::isAsyncLogging())
+            logf(0, 0, 0, 0, "%.*s", (int)len, data);
+        else
+            detail::writeLog(data, len);
+        m_out.truncate(m_start);
     }
-    void operator<<(const QString & msg) { m_msg = msg; }
+
+    LoggerHelper & operator<<(const QString & s) { detail::appendUtf8(m_out, s.utf16(), s.size()); return *this; }
+    LoggerHelper & operator<<(const QByteArray & s) { m_out.append(s.constData(), s.size()); return *this; }
+    LoggerHelper & operator<<(const char * s) { m_out.append(s ? s : "(null)"); return *this; }
+    LoggerHelper & operator<<(char c) { m_out.append(&c, 1); return *this; }
+    LoggerHelper & operator<<(bool b) { m_out.append(b ? "true" : "false"); return *this; }
+    LoggerHelper & operator<<(int n) { m_out.appendInt(n); return *this; }
+    LoggerHelper & operator<<(long n) { m_out.appendInt(n); return *this; }
+    LoggerHelper & operator<<(long long n) { m_out.appendInt(n); return *this; }
+    LoggerHelper & operator<<(unsigned n) { m_out.appendUInt(n); return *this; }
+    LoggerHelper & operator<<(unsigned long n) { m_out.appendUInt(n); return *this; }
+    LoggerHelper & operator<<(unsigned long long n) { m_out.appendUInt(n); return *this; }
+    LoggerHelper & operator<<(double d) { m_out.appendf("%g", d); return *this; }
+    LoggerHelper & operator<<(const void * p) { m_out.appendf("%p", p); return *this; }
 
 private:
-    const char * m_dt;
-    const ELogLevel::E m_level;
-    const char * m_file;
-    const int m_line;
-    QString m_msg;
+    LoggerHelper(const LoggerHelper &);
+    LoggerHelper & operator=(const LoggerHelper &);
+
+    detail::LogLine & m_out;
+    const size_t m_start;
+};
+
+/**
+ * Turns "LoggerHelper << ..." into void, so it can be the other branch of the
+ * conditional operator in LOG().
+ */
+struct LogVoidify
+{
+    void operator&(const LoggerHelper &) { }
 };
 
 } // namespace
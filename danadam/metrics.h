@@ -0,0 +1,585 @@
+#ifndef DANADAM_METRICS_H_GUARD
+#define DANADAM_METRICS_H_GUARD
+
+/*
+ * Operational metrics: counters, gauges and histograms, exported in the
+ * Prometheus text format.
+ *
+ * Every metric keeps DA_METRICS_SHARDS copies of its value, each on its own
+ * cache line. A thread gets a shard when it first touches a metric (round
+ * robin), so threads on different cores update different cache lines and an
+ * increment is one uncontended relaxed atomic add. Reading sums the shards.
+ *
+ * Like the log macros, DA_COUNTER(), DA_GAUGE() and DA_HISTOGRAM() give the
+ * static metric of the callsite where they are expanded; it registers itself
+ * when first reached. Metrics can also be ordinary (static) objects.
+ * Metrics with the same name are added together on export, so a name may be
+ * used at more than one callsite. A name may have Prometheus labels,
+ * 'requests_total{code="404"}'.
+ *
+ * da::prometheusText() renders all registered metrics,
+ * da::startMetricsExporter() writes them periodically to a file (replaced
+ * with a rename, fit for the node_exporter textfile collector) or, with a
+ * "unix:" prefix, to a Unix stream socket.
+ *
+ * Example:
+ *
+ *      DA_COUNTER("requests_total", "Requests handled.").inc();
+ *      DA_GAUGE("connections", "Open connections.").add(1);
+ *      DA_HISTOGRAM("request_seconds", "Request latency.", 0.001, 0.01, 0.1, 1).observe(timer.elapsed() / 1e9);
+ *
+ *      da::startMetricsExporter("/var/lib/node_exporter/myprog.prom", 10000);
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef DA_METRICS_SHARDS
+#  define DA_METRICS_SHARDS 16
+#endif
+
+#ifndef DA_METRICS_MAX_BUCKETS
+#  define DA_METRICS_MAX_BUCKETS 16     // histogram bounds at most, without the implicit +Inf
+#endif
+
+#define DA_COUNTER(name, help) \
+    ([]() -> da::Counter & { \
+        static da::Counter s_daCounter(name, help); \
+        return s_daCounter; \
+    }())
+
+#define DA_GAUGE(name, help) \
+    ([]() -> da::Gauge & { \
+        static da::Gauge s_daGauge(name, help); \
+        return s_daGauge; \
+    }())
+
+// the bucket upper bounds follow the help, in increasing order
+#define DA_HISTOGRAM(name, help, ...) \
+    ([]() -> da::MetricHistogram & { \
+        static da::MetricHistogram s_daHistogram(name, help, { __VA_ARGS__ }); \
+        return s_daHistogram; \
+    }())
+
+namespace da
+{
+
+struct EMetricType
+{
+    enum E { counter, gauge, histogram };
+};
+
+inline std::string prometheusText();
+inline bool writePrometheusText(const char * path);
+inline bool startMetricsExporter(const char * path, int intervalMs);
+inline void stopMetricsExporter();
+
+class Metric;
+
+    namespace detail
+    {
+
+    struct MetricRegistry
+    {
+        std::mutex mutex;
+        std::vector<Metric *> metrics;
+    };
+
+    inline MetricRegistry & metricRegistry()
+    {
+        static MetricRegistry s_registry;
+        return s_registry;
+    }
+
+    inline int metricShard()
+    {
+        static std::atomic<unsigned> s_nextShard(0);
+        static thread_local int t_shard = (int)(s_nextShard.fetch_add(1, std::memory_order_relaxed) % DA_METRICS_SHARDS);
+        return t_shard;
+    }
+
+    template<typename T>
+    struct alignas(64) MetricShard
+    {
+        std::atomic<T> value;
+    };
+
+    } // namespace detail
+
+/**
+ * What the metrics have in common, registered for the export for as long as
+ * it exists.
+ */
+class Metric
+{
+public:
+    const char * name() const { return m_name; }
+    const char * help() const { return m_help; }
+    EMetricType::E type() const { return m_type; }
+
+protected:
+    Metric(const char * name, const char * help, EMetricType::E type)
+        : m_name(name)
+        , m_help(help)
+        , m_type(type)
+    { }
+
+    // by the derived constructor when its shards are initialized, an export could read them right away
+    void registerMetric()
+    {
+        detail::MetricRegistry & registry = detail::metricRegistry();
+        std::lock_guard<std::mutex> locker(registry.mutex);
+        registry.metrics.push_back(this);
+    }
+
+    ~Metric()
+    {
+        detail::MetricRegistry & registry = detail::metricRegistry();
+        std::lock_guard<std::mutex> locker(registry.mutex);
+        registry.metrics.erase(std::find(registry.metrics.begin(), registry.metrics.end(), this));
+    }
+
+private:
+    Metric(const Metric &);
+    Metric & operator=(const Metric &);
+
+    const char * const m_name;
+    const char * const m_help;
+    const EMetricType::E m_type;
+};
+
+class Counter : public Metric
+{
+public:
+    Counter(const char * name, const char * help)
+        : Metric(name, help, EMetricType::counter)
+    {
+        for (int i = 0; i < DA_METRICS_SHARDS; i++)
+            m_shards[i].value.store(0, std::memory_order_relaxed);
+        registerMetric();
+    }
+
+    void inc() { add(1); }
+    void add(uint64_t n) { m_shards[detail::metricShard()].value.fetch_add(n, std::memory_order_relaxed); }
+
+    uint64_t value() const
+    {
+        uint64_t sum = 0;
+        for (int i = 0; i < DA_METRICS_SHARDS; i++)
+            sum += m_shards[i].value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    detail::MetricShard<uint64_t> m_shards[DA_METRICS_SHARDS];
+};
+
+/**
+ * add() and sub() go to the shards, set() overwrites the sum; a set() racing
+ * with an add() may lose the add. Use a gauge for one or the other.
+ */
+class Gauge : public Metric
+{
+public:
+    Gauge(const char * name, const char * help)
+        : Metric(name, help, EMetricType::gauge)
+        , m_base(0)
+    {
+        for (int i = 0; i < DA_METRICS_SHARDS; i++)
+            m_shards[i].value.store(0, std::memory_order_relaxed);
+        registerMetric();
+    }
+
+    void add(int64_t n) { m_shards[detail::metricShard()].value.fetch_add(n, std::memory_order_relaxed); }
+    void sub(int64_t n) { add(-n); }
+    void set(int64_t value) { m_base.store(value - shardSum(), std::memory_order_relaxed); }
+
+    int64_t value() const { return m_base.load(std::memory_order_relaxed) + shardSum(); }
+
+private:
+    int64_t shardSum() const
+    {
+        int64_t sum = 0;
+        for (int i = 0; i < DA_METRICS_SHARDS; i++)
+            sum += m_shards[i].value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    std::atomic<int64_t> m_base;
+    detail::MetricShard<int64_t> m_shards[DA_METRICS_SHARDS];
+};
+
+/**
+ * Prometheus histogram: a count per bucket upper bound (and one for +Inf),
+ * the count and the sum of all the values. Bounds past
+ * DA_METRICS_MAX_BUCKETS are ignored.
+ */
+class MetricHistogram : public Metric
+{
+public:
+    MetricHistogram(const char * name, const char * help, std::initializer_list<double> bounds)
+        : Metric(name, help, EMetricType::histogram)
+        , m_boundCount(0)
+    {
+        for (std::initializer_list<double>::const_iterator it = bounds.begin(); it != bounds.end() && m_boundCount < DA_METRICS_MAX_BUCKETS; ++it)
+            m_bounds[m_boundCount++] = *it;
+        for (int i = 0; i < DA_METRICS_SHARDS; i++)
+        {
+            for (int b = 0; b <= DA_METRICS_MAX_BUCKETS; b++)
+                m_shards[i].counts[b].store(0, std::memory_order_relaxed);
+            m_shards[i].sum.store(0, std::memory_order_relaxed);
+        }
+        registerMetric();
+    }
+
+    void observe(double value)
+    {
+        int bucket = 0;
+        while (bucket < m_boundCount && value > m_bounds[bucket])
+            bucket++;
+        Shard & shard = m_shards[detail::metricShard()];
+        shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        // no fetch_add for double; the shard is rarely shared, so the loop rarely repeats
+        double sum = shard.sum.load(std::memory_order_relaxed);
+        while (!shard.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+            ;
+    }
+
+    int boundCount() const { return m_boundCount; }
+    double bound(int bucket) const { return bucket < m_boundCount ? m_bounds[bucket] : INFINITY; }
+
+    // of values above the previous bound and not above bound(bucket), not cumulative
+    uint64_t bucketCount(int bucket) const
+    {
+        uint64_t count = 0;
+        for (int i = 0; i < DA_METRICS_SHARDS; i++)
+            count += m_shards[i].counts[bucket].load(std::memory_order_relaxed);
+        return count;
+    }
+
+    uint64_t count() const
+    {
+        uint64_t count = 0;
+        for (int b = 0; b <= m_boundCount; b++)
+            count += bucketCount(b);
+        return count;
+    }
+
+    double sum() const
+    {
+        double sum = 0;
+        for (int i = 0; i < DA_METRICS_SHARDS; i++)
+            sum += m_shards[i].sum.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> counts[DA_METRICS_MAX_BUCKETS + 1];
+        std::atomic<double> sum;
+    };
+
+    double m_bounds[DA_METRICS_MAX_BUCKETS];
+    int m_boundCount;
+    Shard m_shards[DA_METRICS_SHARDS];
+};
+
+    namespace detail
+    {
+
+    // HELP text escaping of the exposition format
+    inline std::string escapeMetricHelp(const char * help)
+    {
+        std::string s;
+        for (const char * c = help; *c; c++)
+        {
+            if (*c == '\\')
+                s += "\\\\";
+            else if (*c == '\n')
+                s += "\\n";
+            else
+                s += *c;
+        }
+        return s;
+    }
+
+    inline std::string formatMetricValue(double value)
+    {
+        if (isinf(value))
+            return value > 0 ? "+Inf" : "-Inf";
+        // the shortest of the two which reads back the same, 0.1 rather than 0.10000000000000001
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.15g", value);
+        if (strtod(buf, 0) != value)
+            snprintf(buf, sizeof(buf), "%.17g", value);
+        return buf;
+    }
+
+    // 'name{labels}' + suffix and one more label
+    inline std::string metricSeries(const std::string & name, const char * suffix, const std::string & label)
+    {
+        const size_t brace = name.find('{');
+        const std::string family = name.substr(0, brace);
+        std::string labels = brace == std::string::npos ? std::string() : name.substr(brace + 1, name.size() - brace - 2);
+        if (!label.empty())
+            labels += labels.empty() ? label : "," + label;
+        return family + suffix + (labels.empty() ? std::string() : "{" + labels + "}");
+    }
+
+    // the metrics of one name, added together
+    struct MetricSeries
+    {
+        MetricSeries() : type(EMetricType::counter), help(""), value(0), count(0), sum(0) { }
+
+        EMetricType::E type;
+        const char * help;
+        double value;
+        std::vector<double> bounds;
+        std::vector<uint64_t> buckets;
+        uint64_t count;
+        double sum;
+    };
+
+    // registry.mutex must be locked
+    inline void addMetric(MetricSeries & series, const Metric & metric)
+    {
+        series.type = metric.type();
+        series.help = metric.help();
+        switch (metric.type())
+        {
+            case EMetricType::counter:
+                series.value += static_cast<const Counter &>(metric).value();
+                break;
+            case EMetricType::gauge:
+                series.value += static_cast<const Gauge &>(metric).value();
+                break;
+            case EMetricType::histogram:
+            {
+                const MetricHistogram & histogram = static_cast<const MetricHistogram &>(metric);
+                if (series.bounds.empty() && series.buckets.empty())
+                {
+                    for (int b = 0; b <= histogram.boundCount(); b++)
+                        series.bounds.push_back(histogram.bound(b));
+                    series.buckets.resize(series.bounds.size(), 0);
+                }
+                // a histogram with other bounds than the first of its name goes to its +Inf bucket only
+                bool sameBounds = (int)series.bounds.size() == histogram.boundCount() + 1;
+                for (int b = 0; sameBounds && b < histogram.boundCount(); b++)
+                    sameBounds = series.bounds[b] == histogram.bound(b);
+                for (int b = 0; b <= histogram.boundCount(); b++)
+                    series.buckets[sameBounds ? b : series.buckets.size() - 1] += histogram.bucketCount(b);
+                series.count += histogram.count();
+                series.sum += histogram.sum();
+                break;
+            }
+        }
+    }
+
+    } // namespace detail
+
+/**
+ * All registered metrics in the Prometheus text exposition format, families
+ * sorted by name.
+ */
+inline std::string prometheusText()
+{
+    // family name -> full name -> series
+    std::map<std::string, std::map<std::string, detail::MetricSeries> > families;
+    {
+        detail::MetricRegistry & registry = detail::metricRegistry();
+        std::lock_guard<std::mutex> locker(registry.mutex);
+        for (size_t i = 0; i < registry.metrics.size(); i++)
+        {
+            const Metric & metric = *registry.metrics[i];
+            const std::string name = metric.name();
+            detail::addMetric(families[name.substr(0, name.find('{'))][name], metric);
+        }
+    }
+
+    static const char * const typeNames[] = { "counter", "gauge", "histogram" };
+    std::string s;
+    for (std::map<std::string, std::map<std::string, detail::MetricSeries> >::const_iterator family = families.begin();
+            family != families.end(); ++family)
+    {
+        const detail::MetricSeries & first = family->second.begin()->second;
+        s += "# HELP " + family->first + " " + detail::escapeMetricHelp(first.help) + "\n";
+        s += "# TYPE " + family->first + " " + typeNames[first.type] + "\n";
+        for (std::map<std::string, detail::MetricSeries>::const_iterator it = family->second.begin(); it != family->second.end(); ++it)
+        {
+            const detail::MetricSeries & series = it->second;
+            if (series.type != EMetricType::histogram)
+            {
+                s += it->first + " " + detail::formatMetricValue(series.value) + "\n";
+                continue;
+            }
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b < series.buckets.size(); b++)
+            {
+                cumulative += series.buckets[b];
+                s += detail::metricSeries(it->first, "_bucket", "le=\"" + detail::formatMetricValue(series.bounds[b]) + "\"")
+                        + " " + detail::formatMetricValue((double)cumulative) + "\n";
+            }
+            s += detail::metricSeries(it->first, "_sum", "") + " " + detail::formatMetricValue(series.sum) + "\n";
+            s += detail::metricSeries(it->first, "_count", "") + " " + detail::formatMetricValue((double)series.count) + "\n";
+        }
+    }
+    return s;
+}
+
+/**
+ * Writes prometheusText() to path, through a temporary file and a rename so a
+ * reader never sees half of it, or with "unix:/some/path" sends it to the
+ * Unix stream socket there. Returns false on failure.
+ */
+inline bool writePrometheusText(const char * path)
+{
+    const std::string text = prometheusText();
+    if (strncmp(path, "unix:", 5) == 0)
+    {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(path + 5) >= sizeof(address.sun_path))
+            return false;
+        strcpy(address.sun_path, path + 5);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return false;
+        bool ok = connect(fd, (const struct sockaddr *)&address, sizeof(address)) == 0;
+        for (size_t done = 0; ok && done < text.size(); )
+        {
+            const ssize_t n = send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            ok = n > 0;
+            done += ok ? n : 0;
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    const std::string tmpPath = std::string(path) + ".tmp";
+    FILE * out = fopen(tmpPath.c_str(), "w");
+    if (!out)
+        return false;
+    const bool written = fwrite(text.data(), 1, text.size(), out) == text.size();
+    if (fclose(out) != 0 || !written || rename(tmpPath.c_str(), path) != 0)
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+    namespace detail
+    {
+
+    class MetricsExporter
+    {
+    public:
+        MetricsExporter()
+            : m_stop(false)
+        {
+            metricRegistry();   // constructed first so it is still there when we export at exit
+        }
+        ~MetricsExporter() { stop(); }
+
+        bool start(const char * path, int intervalMs)
+        {
+            stop();
+
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (!writePrometheusText(path))
+                return false;
+            m_path = path;
+            m_intervalMs = intervalMs > 0 ? intervalMs : 1;
+            m_stop = false;
+            m_thread = std::thread(&MetricsExporter::run, this);
+            return true;
+        }
+
+        void stop()
+        {
+            std::lock_guard<std::mutex> startLocker(m_startMutex);
+            if (!m_thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                m_stop = true;
+            }
+            m_condition.notify_one();
+            m_thread.join();
+        }
+
+    private:
+        MetricsExporter(const MetricsExporter &);
+        MetricsExporter & operator=(const MetricsExporter &);
+
+        void run()
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            while (!m_condition.wait_for(locker, std::chrono::milliseconds(m_intervalMs), [this]() { return m_stop; }))
+            {
+                locker.unlock();
+                writePrometheusText(m_path.c_str());      // a failure is retried the next time
+                locker.lock();
+            }
+            locker.unlock();
+            writePrometheusText(m_path.c_str());          // the final values
+        }
+
+        std::mutex m_startMutex;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        bool m_stop;
+        std::string m_path;
+        int m_intervalMs;
+        std::thread m_thread;
+    };
+
+    inline MetricsExporter & metricsExporter()
+    {
+        static MetricsExporter s_exporter;
+        return s_exporter;
+    }
+
+    } // namespace detail
+
+/**
+ * Writes the metrics every intervalMs milliseconds, see writePrometheusText()
+ * for the path, and once more when stopped. Only one exporter runs, a second
+ * call replaces the first one. Returns false if the first write fails.
+ */
+inline bool startMetricsExporter(const char * path, int intervalMs)
+{
+    return detail::metricsExporter().start(path, intervalMs);
+}
+
+inline void stopMetricsExporter()
+{
+    detail::metricsExporter().stop();
+}
+
+} // namespace
+
+#endif
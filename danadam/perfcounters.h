@@ -0,0 +1,257 @@
+#ifndef DANADAM_PERF_COUNTERS_H_GUARD
+#define DANADAM_PERF_COUNTERS_H_GUARD
+
+/*
+ * Hardware performance counters of the calling thread (Linux
+ * perf_event_open()): cycles, instructions, L1D read misses, last level cache
+ * misses and branch misses, user space only.
+ *
+ * Each thread opens its own counter group on first use; the whole group is
+ * read with a single read() call. A counter the CPU (or the VM) doesn't have
+ * is left out, the others still work. If none can be opened, e.g.
+ * perf_event_paranoid is 3 or there is no PMU, reading gives no counters and
+ * da::perfCountersError() says why. On other systems there are never any.
+ *
+ * The profiler (profiler.h) adds the deltas to its zones after
+ * da::setProfileCounters(true).
+ *
+ * Example:
+ *
+ *      da::PerfCounterValues before, after;
+ *      da::readPerfCounters(&before);
+ *      work();
+ *      da::readPerfCounters(&after);
+ *      if (after.has(da::EPerfCounter::instructions))
+ *          printf("%llu instructions\n", after.delta(before, da::EPerfCounter::instructions));
+ */
+
+#include <string>
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__linux__)
+#  include <errno.h>
+#  include <linux/perf_event.h>
+#  include <stdio.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+namespace da
+{
+
+struct EPerfCounter
+{
+    enum E { cycles, instructions, l1dMisses, llcMisses, branchMisses, count };
+    static inline const char * c_str(E e);
+};
+
+struct PerfCounterValues
+{
+    PerfCounterValues() : mask(0) { memset(values, 0, sizeof(values)); }
+
+    bool has(EPerfCounter::E counter) const { return mask & (1u << counter); }
+    unsigned long long delta(const PerfCounterValues & before, EPerfCounter::E counter) const
+    {
+        return values[counter] - before.values[counter];
+    }
+
+    uint64_t values[EPerfCounter::count];
+    unsigned mask;          // bit per counter which could be opened
+};
+
+inline bool readPerfCounters(PerfCounterValues * values);
+inline std::string perfCountersError();
+
+const char * EPerfCounter::c_str(E e)
+{
+    switch (e)
+    {
+        case cycles:        return "cycles";
+        case instructions:  return "instructions";
+        case l1dMisses:     return "L1D misses";
+        case llcMisses:     return "LLC misses";
+        case branchMisses:  return "branch misses";
+        case count:         break;
+    }
+    return "???";
+}
+
+    namespace detail
+    {
+
+#if defined(__linux__)
+    class PerfCounterGroup
+    {
+    public:
+        PerfCounterGroup()
+            : m_leader(-1)
+            , m_opened(0)
+            , m_mask(0)
+        {
+            for (int i = 0; i < EPerfCounter::count; i++)
+                m_fds[i] = -1;
+            open();
+        }
+
+        ~PerfCounterGroup()
+        {
+            for (int i = 0; i < EPerfCounter::count; i++)
+            {
+                if (m_fds[i] >= 0)
+                    ::close(m_fds[i]);
+            }
+        }
+
+        bool read(PerfCounterValues * values) const
+        {
+            values->mask = 0;
+            if (m_leader < 0)
+                return false;
+
+            // PERF_FORMAT_GROUP: the number of counters, then their values in the order of opening
+            uint64_t buf[1 + EPerfCounter::count];
+            const ssize_t len = ::read(m_leader, buf, sizeof(buf));
+            if (len < (ssize_t)sizeof(uint64_t) || buf[0] != (uint64_t)m_opened)
+                return false;
+            int n = 0;
+            for (int i = 0; i < EPerfCounter::count; i++)
+            {
+                if (m_mask & (1u << i))
+                    values->values[i] = buf[1 + n++];
+            }
+            values->mask = m_mask;
+            return true;
+        }
+
+        const std::string & error() const { return m_error; }
+
+    private:
+        PerfCounterGroup(const PerfCounterGroup &);
+        PerfCounterGroup & operator=(const PerfCounterGroup &);
+
+        static void counterConfig(int counter, struct perf_event_attr * attr)
+        {
+            switch (counter)
+            {
+                case EPerfCounter::cycles:
+                    attr->type = PERF_TYPE_HARDWARE;
+                    attr->config = PERF_COUNT_HW_CPU_CYCLES;
+                    break;
+                case EPerfCounter::instructions:
+                    attr->type = PERF_TYPE_HARDWARE;
+                    attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+                    break;
+                case EPerfCounter::l1dMisses:
+                    attr->type = PERF_TYPE_HW_CACHE;
+                    attr->config = PERF_COUNT_HW_CACHE_L1D
+                        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                    break;
+                case EPerfCounter::llcMisses:
+                    attr->type = PERF_TYPE_HARDWARE;
+                    attr->config = PERF_COUNT_HW_CACHE_MISSES;
+                    break;
+                default:
+                    attr->type = PERF_TYPE_HARDWARE;
+                    attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+                    break;
+            }
+        }
+
+        void open()
+        {
+            int firstErrno = 0;
+            for (int i = 0; i < EPerfCounter::count; i++)
+            {
+                struct perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                counterConfig(i, &attr);
+                attr.disabled = m_leader < 0;       // the group starts when the leader is enabled
+                attr.exclude_kernel = 1;            // allowed with perf_event_paranoid <= 2
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+
+                const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, m_leader, PERF_FLAG_FD_CLOEXEC);
+                if (fd < 0)
+                {
+                    if (!firstErrno)
+                        firstErrno = errno;
+                    continue;
+                }
+                m_fds[i] = fd;
+                if (m_leader < 0)
+                    m_leader = fd;
+                m_mask |= 1u << i;
+                m_opened++;
+            }
+
+            if (m_leader >= 0)
+            {
+                ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+                return;
+            }
+
+            m_error = std::string("perf_event_open: ") + strerror(firstErrno);
+            if (firstErrno == EACCES || firstErrno == EPERM)
+            {
+                int paranoid = 0;
+                if (FILE * f = fopen("/proc/sys/kernel/perf_event_paranoid", "r"))
+                {
+                    if (fscanf(f, "%d", &paranoid) == 1)
+                        m_error += " (perf_event_paranoid is " + std::to_string(paranoid) + ")";
+                    fclose(f);
+                }
+            }
+            else if (firstErrno == ENOENT || firstErrno == EOPNOTSUPP)
+                m_error += " (no hardware counters, a VM without PMU?)";
+        }
+
+        int m_fds[EPerfCounter::count];
+        int m_leader;
+        int m_opened;
+        unsigned m_mask;
+        std::string m_error;
+    };
+
+    inline PerfCounterGroup & threadPerfCounterGroup()
+    {
+        static thread_local PerfCounterGroup t_group;
+        return t_group;
+    }
+#endif
+
+    } // namespace detail
+
+/**
+ * Reads the counters of the calling thread, opening them the first time.
+ * Returns false (and values->mask is 0) if there are none.
+ */
+inline bool readPerfCounters(PerfCounterValues * values)
+{
+#if defined(__linux__)
+    return detail::threadPerfCounterGroup().read(values);
+#else
+    values->mask = 0;
+    return false;
+#endif
+}
+
+/**
+ * Why the calling thread has no counters, "" if it has some.
+ */
+inline std::string perfCountersError()
+{
+#if defined(__linux__)
+    return detail::threadPerfCounterGroup().error();
+#else
+    return "performance counters need Linux";
+#endif
+}
+
+} // namespace
+
+#endif
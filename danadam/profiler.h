@@ -0,0 +1,476 @@
+#ifndef DANADAM_PROFILER_H_GUARD
+#define DANADAM_PROFILER_H_GUARD
+
+// requires: MyQtDebug.h (for ElapsedTimer.h)
+
+/*
+ * Scoped profiling zones.
+ *
+ * DA_PROFILE_SCOPE("name") times the rest of the enclosing block with a TSC
+ * ElapsedTimer (monotonic where the TSC is not usable). Every expansion has
+ * its own static zone. Each thread keeps call count, total, min and max time
+ * per zone in its own table, so recording takes no lock and shares no cache
+ * line with other threads. da::profileReport() merges the tables of all
+ * threads, the running and the finished ones, into a report sorted by the
+ * total time.
+ *
+ * While tracing (see tracer.h) each scope is also added to the timeline.
+ *
+ * After da::setProfileCounters(true) each scope also reads the hardware
+ * counters of its thread (see perfcounters.h) when it starts and ends, and the
+ * report shows their average per call next to the times. That is two read()
+ * system calls per scope, so it is off by default and meant for zones which
+ * take microseconds or more. Without counters (not Linux, perf_event_paranoid
+ * too high, no PMU) the columns show "-".
+ *
+ * The zone name has to outlive the program (a string literal). A report taken
+ * while other threads record may be a bit off for their zones (the count of
+ * one call, the total of the next), it is not locked against them.
+ *
+ * Example:
+ *
+ *      void parse()
+ *      {
+ *          DA_PROFILE_SCOPE("parse");
+ *          ...
+ *      }
+ *
+ *      da::printProfileReportAtExit();
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ElapsedTimer.h"
+#include "perfcounters.h"
+#include "scopeguard.h"
+#include "tracer.h"
+
+#ifndef DA_PROFILE_MAX_ZONES
+#  define DA_PROFILE_MAX_ZONES 4096     // zones past this many are not recorded
+#endif
+
+#define DA_PROFILE_SCOPE(name) \
+    static da::ProfileZone ANONYMOUS_VARIABLE(s_daProfileZone)(name, __FILE__, __LINE__); \
+    da::ProfileScope ANONYMOUS_VARIABLE(daProfileScope)(ANONYMOUS_VARIABLE(s_daProfileZone))
+
+namespace da
+{
+
+struct ProfileZoneReport
+{
+    const char * name;
+    const char * file;
+    int line;
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t minNs;
+    uint64_t maxNs;
+    uint64_t countedCalls;                          // calls which read the counters
+    uint64_t counters[EPerfCounter::count];         // totals over the counted calls
+    unsigned counterMask;                           // bit per counter which was read
+};
+
+inline void setProfileCounters(bool enabled);
+inline std::vector<ProfileZoneReport> profileReport();
+inline std::string profileReportString();
+inline void printProfileReport(FILE * out = stderr);
+inline void printProfileReportAtExit();
+
+class ProfileZone
+{
+public:
+    static const int unregistered = -1;
+
+    constexpr ProfileZone(const char * name, const char * file, int line)
+        : m_name(name)
+        , m_file(file)
+        , m_line(line)
+        , m_id(unregistered)
+    { }
+
+    const char * name() const { return m_name; }
+    const char * file() const { return m_file; }
+    int line() const { return m_line; }
+
+    // index in the thread tables, given on first use
+    int id()
+    {
+        const int id = m_id.load(std::memory_order_acquire);
+        return id != unregistered ? id : registerZone();
+    }
+
+private:
+    inline int registerZone();
+
+    const char * const m_name;
+    const char * const m_file;
+    const int m_line;
+    std::atomic<int> m_id;
+};
+
+    namespace detail
+    {
+
+    template<typename T = void>
+    struct ProfileState
+    {
+        static std::atomic<bool> s_counters;
+    };
+
+    template<typename T>
+    std::atomic<bool> ProfileState<T>::s_counters(false);
+
+    /**
+     * Written by the owning thread only, read by reports. Relaxed loads and
+     * stores instead of read-modify-writes, which cost a locked instruction
+     * each.
+     */
+    struct ProfileStats
+    {
+        ProfileStats() : count(0), totalNs(0), minNs(UINT64_MAX), maxNs(0), countedCalls(0), counterMask(0)
+        {
+            for (int i = 0; i < EPerfCounter::count; i++)
+                counters[i].store(0, std::memory_order_relaxed);
+        }
+
+        void record(uint64_t ns)
+        {
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            totalNs.store(totalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+            if (ns < minNs.load(std::memory_order_relaxed))
+                minNs.store(ns, std::memory_order_relaxed);
+            if (ns > maxNs.load(std::memory_order_relaxed))
+                maxNs.store(ns, std::memory_order_relaxed);
+        }
+
+        void recordCounters(const PerfCounterValues & before, const PerfCounterValues & after)
+        {
+            countedCalls.store(countedCalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            for (int i = 0; i < EPerfCounter::count; i++)
+            {
+                if (after.has(EPerfCounter::E(i)))
+                    counters[i].store(counters[i].load(std::memory_order_relaxed) + after.delta(before, EPerfCounter::E(i)), std::memory_order_relaxed);
+            }
+            // the same for every call of a thread, its counter group doesn't change
+            if (counterMask.load(std::memory_order_relaxed) != after.mask)
+                counterMask.store(after.mask, std::memory_order_relaxed);
+        }
+
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> totalNs;
+        std::atomic<uint64_t> minNs;
+        std::atomic<uint64_t> maxNs;
+        std::atomic<uint64_t> countedCalls;
+        std::atomic<uint64_t> counters[EPerfCounter::count];
+        std::atomic<unsigned> counterMask;
+    };
+
+    inline void mergeProfileStats(ProfileZoneReport & to, const ProfileStats & stats)
+    {
+        to.count += stats.count.load(std::memory_order_relaxed);
+        to.totalNs += stats.totalNs.load(std::memory_order_relaxed);
+        to.minNs = std::min(to.minNs, (uint64_t)stats.minNs.load(std::memory_order_relaxed));
+        to.maxNs = std::max(to.maxNs, (uint64_t)stats.maxNs.load(std::memory_order_relaxed));
+        to.countedCalls += stats.countedCalls.load(std::memory_order_relaxed);
+        for (int i = 0; i < EPerfCounter::count; i++)
+            to.counters[i] += stats.counters[i].load(std::memory_order_relaxed);
+        to.counterMask |= stats.counterMask.load(std::memory_order_relaxed);
+    }
+
+    class ProfileThreadTable;
+
+    struct ProfileRegistry
+    {
+        std::mutex mutex;
+        std::vector<ProfileZone *> zones;               // by id
+        std::vector<ProfileThreadTable *> tables;       // of the running threads
+        std::vector<ProfileZoneReport> finished;        // of the finished threads, by id
+    };
+
+    inline ProfileRegistry & profileRegistry()
+    {
+        static ProfileRegistry s_registry;
+        return s_registry;
+    }
+
+    /**
+     * The stats of one thread. They are in chunks which are never moved, so
+     * a report can read them while the thread adds new ones.
+     */
+    class ProfileThreadTable
+    {
+    public:
+        static const int chunkSize = 64;
+        static const int chunkCount = (DA_PROFILE_MAX_ZONES + chunkSize - 1) / chunkSize;
+
+        ProfileThreadTable()
+        {
+            for (int i = 0; i < chunkCount; i++)
+                m_chunks[i].store(0, std::memory_order_relaxed);
+
+            ProfileRegistry & registry = profileRegistry();
+            std::lock_guard<std::mutex> locker(registry.mutex);
+            registry.tables.push_back(this);
+        }
+
+        ~ProfileThreadTable()
+        {
+            ProfileRegistry & registry = profileRegistry();
+            {
+                std::lock_guard<std::mutex> locker(registry.mutex);
+                registry.tables.erase(std::find(registry.tables.begin(), registry.tables.end(), this));
+                mergeInto(registry.finished);
+            }
+            for (int i = 0; i < chunkCount; i++)
+                delete[] m_chunks[i].load(std::memory_order_relaxed);
+        }
+
+        // null past DA_PROFILE_MAX_ZONES
+        ProfileStats * stats(int id)
+        {
+            if (id >= DA_PROFILE_MAX_ZONES)
+                return 0;
+            ProfileStats * chunk = m_chunks[id / chunkSize].load(std::memory_order_relaxed);
+            if (!chunk)
+            {
+                chunk = new ProfileStats[chunkSize];
+                m_chunks[id / chunkSize].store(chunk, std::memory_order_release);
+            }
+            return &chunk[id % chunkSize];
+        }
+
+        // registry.mutex must be locked
+        void mergeInto(std::vector<ProfileZoneReport> & reports) const
+        {
+            for (size_t id = 0; id < reports.size() && id < (size_t)DA_PROFILE_MAX_ZONES; id++)
+            {
+                const ProfileStats * chunk = m_chunks[id / chunkSize].load(std::memory_order_acquire);
+                if (!chunk)
+                    continue;
+                mergeProfileStats(reports[id], chunk[id % chunkSize]);
+            }
+        }
+
+    private:
+        ProfileThreadTable(const ProfileThreadTable &);
+        ProfileThreadTable & operator=(const ProfileThreadTable &);
+
+        std::atomic<ProfileStats *> m_chunks[chunkCount];
+    };
+
+    inline ProfileThreadTable & profileThreadTable()
+    {
+        static thread_local ProfileThreadTable t_table;
+        return t_table;
+    }
+
+    inline ProfileZoneReport emptyProfileZoneReport(const ProfileZone & zone)
+    {
+        const ProfileZoneReport report = { zone.name(), zone.file(), zone.line(), 0, 0, UINT64_MAX, 0, 0, { 0 }, 0 };
+        return report;
+    }
+
+    inline PerfCounterValues startProfileCounters()
+    {
+        PerfCounterValues values;
+        if (ProfileState<>::s_counters.load(std::memory_order_relaxed))
+            readPerfCounters(&values);
+        return values;
+    }
+
+    } // namespace detail
+
+int ProfileZone::registerZone()
+{
+    detail::ProfileRegistry & registry = detail::profileRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+    int id = m_id.load(std::memory_order_relaxed);
+    if (id == unregistered)
+    {
+        id = (int)registry.zones.size();
+        registry.zones.push_back(this);
+        registry.finished.push_back(detail::emptyProfileZoneReport(*this));
+        m_id.store(id, std::memory_order_release);
+    }
+    return id;
+}
+
+/**
+ * Times its own lifetime and adds it to the zone, see DA_PROFILE_SCOPE().
+ */
+class ProfileScope
+{
+public:
+    explicit ProfileScope(ProfileZone & zone)
+        : m_zone(zone)
+        , m_id(zone.id())
+        , m_traceStartNs(detail::isTracing() ? detail::traceNowNs() : 0)
+        , m_counters(detail::startProfileCounters())
+        , m_timer(ElapsedTimer::tsc)
+    { }
+
+    ~ProfileScope()
+    {
+        const uint64_t ns = m_timer.elapsed();
+        if (detail::ProfileStats * stats = detail::profileThreadTable().stats(m_id))
+        {
+            stats->record(ns);
+            PerfCounterValues counters;
+            if (m_counters.mask && readPerfCounters(&counters))
+                stats->recordCounters(m_counters, counters);
+        }
+        // the timeline is in CLOCK_MONOTONIC, the TSC could drift from it by its calibration error
+        if (m_traceStartNs)
+            detail::traceEvent(m_zone.name(), m_traceStartNs, detail::traceNowNs() - m_traceStartNs);
+    }
+
+private:
+    ProfileScope(const ProfileScope &);
+    ProfileScope & operator=(const ProfileScope &);
+
+    const ProfileZone & m_zone;
+    const int m_id;
+    const uint64_t m_traceStartNs;     // 0 if not tracing
+    const PerfCounterValues m_counters;     // none if not counting, read before the timer starts
+    ElapsedTimer m_timer;
+};
+
+/**
+ * Whether scopes read the hardware counters, see perfcounters.h. Scopes which
+ * started before the change keep what they did.
+ */
+inline void setProfileCounters(bool enabled)
+{
+    detail::ProfileState<>::s_counters.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * The zones which were entered at least once, of all threads together,
+ * sorted by the total time, longest first.
+ */
+inline std::vector<ProfileZoneReport> profileReport()
+{
+    std::vector<ProfileZoneReport> reports;
+    {
+        detail::ProfileRegistry & registry = detail::profileRegistry();
+        std::lock_guard<std::mutex> locker(registry.mutex);
+        reports = registry.finished;
+        for (size_t i = 0; i < registry.tables.size(); i++)
+            registry.tables[i]->mergeInto(reports);
+    }
+
+    reports.erase(
+            std::remove_if(reports.begin(), reports.end(), [](const ProfileZoneReport & r) { return r.count == 0; }),
+            reports.end()
+        );
+    std::stable_sort(reports.begin(), reports.end(), [](const ProfileZoneReport & a, const ProfileZoneReport & b) {
+        return a.totalNs > b.totalNs;
+    });
+    return reports;
+}
+
+    namespace detail
+    {
+
+    // average per counted call, "-" if the counter wasn't read
+    inline std::string profileCounterColumn(const ProfileZoneReport & r, EPerfCounter::E counter)
+    {
+        char buf[32] = "-";
+        if (r.countedCalls && (r.counterMask & (1u << counter)))
+            snprintf(buf, sizeof(buf), "%.0f", double(r.counters[counter]) / r.countedCalls);
+        return buf;
+    }
+
+    } // namespace detail
+
+/**
+ * The report as a table, times in microseconds. If any zone read the hardware
+ * counters, their averages per call are added before the place.
+ */
+inline std::string profileReportString()
+{
+    const std::vector<ProfileZoneReport> reports = profileReport();
+    bool withCounters = false;
+    for (size_t i = 0; i < reports.size(); i++)
+        withCounters = withCounters || reports[i].countedCalls;
+
+    std::string s;
+    char line[512];
+    snprintf(line, sizeof(line), "%-32s %10s %14s %12s %12s %12s  ",
+            "zone", "calls", "total us", "avg us", "min us", "max us");
+    s += line;
+    if (withCounters)
+    {
+        snprintf(line, sizeof(line), "%12s %12s %6s %10s %10s %10s  ",
+                "cycles", "instr", "IPC", "L1D miss", "LLC miss", "br miss");
+        s += line;
+    }
+    s += "place\n";
+    for (size_t i = 0; i < reports.size(); i++)
+    {
+        const ProfileZoneReport & r = reports[i];
+        snprintf(line, sizeof(line), "%-32s %10llu %14.3f %12.3f %12.3f %12.3f  ",
+                r.name,
+                (unsigned long long)r.count,
+                r.totalNs / 1e3,
+                r.totalNs / 1e3 / r.count,
+                r.minNs / 1e3,
+                r.maxNs / 1e3
+            );
+        s += line;
+        if (withCounters)
+        {
+            const unsigned ipcMask = (1u << EPerfCounter::cycles) | (1u << EPerfCounter::instructions);
+            char ipc[32] = "-";
+            if (r.countedCalls && (r.counterMask & ipcMask) == ipcMask && r.counters[EPerfCounter::cycles])
+                snprintf(ipc, sizeof(ipc), "%.2f", double(r.counters[EPerfCounter::instructions]) / r.counters[EPerfCounter::cycles]);
+            snprintf(line, sizeof(line), "%12s %12s %6s %10s %10s %10s  ",
+                    detail::profileCounterColumn(r, EPerfCounter::cycles).c_str(),
+                    detail::profileCounterColumn(r, EPerfCounter::instructions).c_str(),
+                    ipc,
+                    detail::profileCounterColumn(r, EPerfCounter::l1dMisses).c_str(),
+                    detail::profileCounterColumn(r, EPerfCounter::llcMisses).c_str(),
+                    detail::profileCounterColumn(r, EPerfCounter::branchMisses).c_str()
+                );
+            s += line;
+        }
+        snprintf(line, sizeof(line), "%s:%d\n", r.file, r.line);
+        s += line;
+    }
+    return s;
+}
+
+inline void printProfileReport(FILE * out)
+{
+    const std::string report = profileReportString();
+    fwrite(report.data(), 1, report.size(), out);
+    fflush(out);
+}
+
+/**
+ * Prints the report to stderr at exit. Calling it more than once prints it
+ * once.
+ */
+inline void printProfileReportAtExit()
+{
+    static bool s_registered = false;
+    static std::mutex s_mutex;
+    std::lock_guard<std::mutex> locker(s_mutex);
+    if (s_registered)
+        return;
+    detail::profileRegistry();      // constructed first so it is still there at exit
+    atexit([]() { printProfileReport(stderr); });
+    s_registered = true;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef DANADAM_SAMPLING_PROFILER_H_GUARD
+#define DANADAM_SAMPLING_PROFILER_H_GUARD
+
+/*
+ * In-process sampling profiler, POSIX only.
+ *
+ * da::startSampling() arms an ITIMER_PROF timer, so the kernel sends SIGPROF
+ * to whichever thread is using the CPU, hz times per second of CPU time. The
+ * handler only claims a slot of a preallocated buffer with one atomic
+ * increment and fills it with backtrace(); it takes no lock and allocates
+ * nothing. When the buffer is full further samples are counted as dropped.
+ *
+ * With da::setStackUnwinder(da::EStackUnwinder::framePointers) (see
+ * stacktrace.h) the handler follows the frame pointers of the interrupted
+ * code instead, far cheaper than backtrace(). Only in threads whose stack is
+ * known: ones which called da::initThreadStackBounds() or captured a stack
+ * before, the one calling da::startSampling() included; other threads still
+ * get backtrace().
+ *
+ * da::foldedStacks() symbolizes the samples afterwards, from the ELF symbol
+ * tables (see symbolizer.h) and demangled, into the folded format of Brendan
+ * Gregg's flamegraph.pl: one "outer;...;inner count" line per distinct stack.
+ * Frames without a symbol show as "[file]".
+ *
+ * The process must not use SIGPROF or ITIMER_PROF for anything else. The
+ * handler stays installed after da::stopSampling() so a late signal does no
+ * harm.
+ *
+ * Example:
+ *
+ *      da::startSampling(99);
+ *      sleep(30);
+ *      da::stopSampling();
+ *      da::writeFoldedStacks("/tmp/myprog.folded");
+ *      // flamegraph.pl /tmp/myprog.folded > myprog.svg
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <execinfo.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+#include "scopeguard.h"
+#include "scopeguard_helper.h"
+#include "stacktrace.h"
+
+#ifndef DA_SAMPLING_MAX_DEPTH
+#  define DA_SAMPLING_MAX_DEPTH 64      // frames per sample, deeper stacks lose their outermost frames
+#endif
+
+namespace da
+{
+
+struct SamplingStats
+{
+    uint64_t samples;       // in the buffer
+    uint64_t dropped;       // because the buffer was full
+};
+
+inline bool startSampling(int hz = 99, size_t maxSamples = 16 * 1024);
+inline void stopSampling();
+inline SamplingStats samplingStats();
+inline std::string foldedStacks();
+inline bool writeFoldedStacks(const char * path);
+
+    namespace detail
+    {
+
+    // depth is 0 until the frames are written, -1 if backtrace() found none
+    struct Sample
+    {
+        std::atomic<int> depth;
+        void * frames[DA_SAMPLING_MAX_DEPTH];
+    };
+
+    struct SampleBuffer
+    {
+        explicit SampleBuffer(size_t capacity)
+            : capacity(capacity)
+            , next(0)
+            , dropped(0)
+            , samples(new Sample[capacity])
+        {
+            for (size_t i = 0; i < capacity; i++)
+                samples[i].depth.store(0, std::memory_order_relaxed);
+        }
+
+        const size_t capacity;
+        std::atomic<size_t> next;           // slots claimed so far, may run past capacity
+        std::atomic<uint64_t> dropped;
+        std::unique_ptr<Sample[]> samples;
+    };
+
+    // the buffer the handler writes to, null while not sampling
+    template<typename T = void>
+    struct SamplingState
+    {
+        static std::atomic<SampleBuffer *> s_buffer;
+        static std::atomic<int> s_activeHandlers;
+    };
+
+    template<typename T>
+    std::atomic<SampleBuffer *> SamplingState<T>::s_buffer(0);
+
+    template<typename T>
+    std::atomic<int> SamplingState<T>::s_activeHandlers(0);
+
+    struct SamplingRegistry
+    {
+        SamplingRegistry() : handlerInstalled(false) { }
+
+        std::mutex mutex;
+        bool handlerInstalled;
+        std::unique_ptr<SampleBuffer> buffer;       // of the last session, running or stopped
+    };
+
+    inline SamplingRegistry & samplingRegistry()
+    {
+        static SamplingRegistry s_registry;
+        return s_registry;
+    }
+
+    // frames[0] is the handler, frames[1] the signal trampoline
+    static const int samplingSkippedFrames = 2;
+
+    // the interrupted stack into frames[samplingSkippedFrames] on, like backtrace() does
+    inline int captureSample(void ** frames, void * context)
+    {
+#if DA_FRAME_POINTER_UNWINDER
+        if (stackUnwinder() == EStackUnwinder::framePointers)
+        {
+            const mcontext_t & mc = ((const ucontext_t *)context)->uc_mcontext;
+#  if defined(__x86_64__)
+            void * const pc = (void *)mc.gregs[REG_RIP];
+            void * const fp = (void *)mc.gregs[REG_RBP];
+#  elif defined(__i386__)
+            void * const pc = (void *)mc.gregs[REG_EIP];
+            void * const fp = (void *)mc.gregs[REG_EBP];
+#  else
+            void * const pc = (void *)mc.pc;
+            void * const fp = (void *)mc.regs[29];
+#  endif
+            // the first frame is where the signal came, the record at fp is its caller's
+            const int first = samplingSkippedFrames + 1;
+            const int count = walkFramePointers(frames + first, DA_SAMPLING_MAX_DEPTH - first, fp, false);
+            // nothing above the interrupted function: fp wasn't a frame record
+            if (count >= 1)
+            {
+                frames[samplingSkippedFrames] = pc;
+                return first + count;
+            }
+        }
+#endif
+        (void)context;
+        return backtrace(frames, DA_SAMPLING_MAX_DEPTH);
+    }
+
+    inline void samplingSignalHandler(int, siginfo_t *, void * context)
+    {
+        const int savedErrno = errno;
+        SamplingState<>::s_activeHandlers.fetch_add(1);
+        SampleBuffer * buffer = SamplingState<>::s_buffer.load();
+        if (buffer)
+        {
+            const size_t index = buffer->next.fetch_add(1, std::memory_order_relaxed);
+            if (index < buffer->capacity)
+            {
+                Sample & sample = buffer->samples[index];
+                const int depth = captureSample(sample.frames, context);
+                sample.depth.store(depth > 0 ? depth : -1, std::memory_order_release);
+            }
+            else
+                buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        SamplingState<>::s_activeHandlers.fetch_sub(1);
+        errno = savedErrno;
+    }
+
+    // registry.mutex must be locked; once it returns no handler uses the old buffer any more
+    inline void setSampleBuffer(SampleBuffer * buffer)
+    {
+        SamplingState<>::s_buffer.store(buffer);
+        while (SamplingState<>::s_activeHandlers.load() != 0)
+            sched_yield();
+    }
+
+    inline bool setSamplingTimer(int hz)
+    {
+        struct itimerval timer;
+        memset(&timer, 0, sizeof(timer));
+        if (hz > 0)
+        {
+            // tv_usec must stay below a second
+            const long usec = hz < 1000000 ? 1000000 / hz : 1;
+            timer.it_interval.tv_sec = usec / 1000000;
+            timer.it_interval.tv_usec = usec % 1000000;
+            timer.it_value = timer.it_interval;
+        }
+        return setitimer(ITIMER_PROF, &timer, 0) == 0;
+    }
+
+    } // namespace detail
+
+/**
+ * Starts a new session, the samples of the previous one are dropped. Returns
+ * false if the handler or the timer can't be set up.
+ *
+ * hz         - Samples per second of CPU time (of all threads together).
+ * maxSamples - Buffer size, a sample takes DA_SAMPLING_MAX_DEPTH * 8 bytes.
+ */
+inline bool startSampling(int hz, size_t maxSamples)
+{
+    detail::SamplingRegistry & registry = detail::samplingRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+
+    if (!registry.handlerInstalled)
+    {
+        // the first backtrace() loads libgcc, which is not something to do in a signal handler
+        void * frame;
+        backtrace(&frame, 1);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = detail::samplingSignalHandler;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, 0) != 0)
+            return false;
+        registry.handlerInstalled = true;
+    }
+    initThreadStackBounds();
+
+    detail::setSamplingTimer(0);
+    detail::setSampleBuffer(0);
+    registry.buffer.reset(new detail::SampleBuffer(maxSamples > 0 ? maxSamples : 1));
+    detail::setSampleBuffer(registry.buffer.get());
+    if (!detail::setSamplingTimer(hz > 0 ? hz : 1))
+    {
+        detail::setSampleBuffer(0);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stops taking samples. They stay in the buffer for foldedStacks().
+ */
+inline void stopSampling()
+{
+    detail::SamplingRegistry & registry = detail::samplingRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+    detail::setSamplingTimer(0);
+    detail::setSampleBuffer(0);
+}
+
+inline SamplingStats samplingStats()
+{
+    SamplingStats stats = { 0, 0 };
+    detail::SamplingRegistry & registry = detail::samplingRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+    if (registry.buffer)
+    {
+        stats.samples = std::min(registry.buffer->next.load(std::memory_order_relaxed), registry.buffer->capacity);
+        stats.dropped = registry.buffer->dropped.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+/**
+ * The samples of the last session as folded stacks, sorted. It may be called
+ * while sampling, samples still being written are left out.
+ */
+inline std::string foldedStacks()
+{
+    detail::SamplingRegistry & registry = detail::samplingRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+    if (!registry.buffer)
+        return std::string();
+
+    const detail::SampleBuffer & buffer = *registry.buffer;
+    const size_t count = std::min(buffer.next.load(std::memory_order_relaxed), buffer.capacity);
+
+    // the interrupted frame is where the signal came, the outer ones are return addresses;
+    // one byte back is still in the call instruction, so in the calling function
+    std::vector<std::vector<void *> > stacks;
+    std::vector<void *> addresses;
+    for (size_t i = 0; i < count; i++)
+    {
+        const detail::Sample & sample = buffer.samples[i];
+        const int depth = sample.depth.load(std::memory_order_acquire);
+        if (depth <= detail::samplingSkippedFrames)
+            continue;
+        std::vector<void *> stack;
+        for (int f = depth - 1; f >= detail::samplingSkippedFrames; f--)
+        {
+            char * address = (char *)sample.frames[f];
+            stack.push_back(f == detail::samplingSkippedFrames ? address : address - 1);
+        }
+        addresses.insert(addresses.end(), stack.begin(), stack.end());
+        stacks.push_back(stack);
+    }
+
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+    std::map<void *, std::string> functions;
+    for (size_t i = 0; i < addresses.size(); i++)
+    {
+        std::string function;
+        SymbolInfo info;
+        if (symbolize(addresses[i], &info, false))
+        {
+            function = info.function.empty()
+                    ? "[" + info.object + "]"
+                    : detail::demangleSymbol(info.function);
+        }
+        else
+        {
+            char ** symbols = backtrace_symbols(&addresses[i], 1);
+            ON_BLOCK_EXIT(free_ptr<char*>, symbols);
+            function = symbols ? frameFunction(symbols[0]) : "[unknown]";
+        }
+        std::replace(function.begin(), function.end(), ';', ':');      // the frame separator
+        functions[addresses[i]] = function;
+    }
+
+    std::map<std::string, uint64_t> folded;
+    for (size_t i = 0; i < stacks.size(); i++)
+    {
+        std::string line;
+        for (size_t f = 0; f < stacks[i].size(); f++)
+        {
+            if (f)
+                line += ';';
+            line += functions[stacks[i][f]];
+        }
+        folded[line]++;
+    }
+
+    std::string s;
+    char buf[32];
+    for (std::map<std::string, uint64_t>::const_iterator it = folded.begin(); it != folded.end(); ++it)
+    {
+        snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)it->second);
+        s += it->first + buf;
+    }
+    return s;
+}
+
+// returns false if the file can't be written
+inline bool writeFoldedStacks(const char * path)
+{
+    FILE * out = fopen(path, "w");
+    if (!out)
+        return false;
+    const std::string folded = foldedStacks();
+    fwrite(folded.data(), 1, folded.size(), out);
+    return fclose(out) == 0;
+}
+
+} // namespace
+
+#endif
@@ -1,16 +1,45 @@
 #ifndef DANADAM_STACKTRACE_H_GUARD
 #define DANADAM_STACKTRACE_H_GUARD
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <execinfo.h>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include <cxxabi.h>
 
 #include "scopeguard.h"
 #include "scopeguard_helper.h"
+#include "symbolizer.h"
+
+#ifndef DA_STACKTRACE_CACHE_SIZE
+#  define DA_STACKTRACE_CACHE_SIZE 4096     // addresses, power of 2; ones which don't fit are symbolized every time
+#endif
+
+#ifndef DA_STACKTRACE_INTERN_SIZE
+#  define DA_STACKTRACE_INTERN_SIZE 4096    // distinct stacks, power of 2; ones which don't fit get id 0
+#endif
+
+#ifndef DA_STACKTRACE_MAX_DEPTH
+#  define DA_STACKTRACE_MAX_DEPTH 256       // the most setStackTraceDepth() accepts
+#endif
+
+#ifndef DA_STACKTRACE_FRAME_POINTERS
+#  define DA_STACKTRACE_FRAME_POINTERS 0    // 1: EStackUnwinder::framePointers by default
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__))
+#  define DA_FRAME_POINTER_UNWINDER 1       // where a frame record is { caller's record, return address }
+#else
+#  define DA_FRAME_POINTER_UNWINDER 0
+#endif
 
 namespace da
 {
@@ -42,7 +71,7 @@ inline std::string demangleName(char* frame)
             if (fileBeg && !fileLen)
                 fileLen = c - fileBeg;
         }
-        else if (*c == '+' && !offsetBeg)
+        else if (*c == '+' && funcBeg && !offsetBeg)
         {
             offsetBeg = c + 1;
             if (funcBeg && !funcLen)
@@ -52,7 +81,7 @@ inline std::string demangleName(char* frame)
         {
             if (offsetBeg && !offsetLen)
                 offsetLen = c - offsetBeg;
-            if (funcBeg && !funcLen)
+            if (funcBeg && !funcLen && !offsetBeg)
                 funcLen = c - funcBeg;
         }
         else if (*c == '[' && !returnBeg)
@@ -114,6 +143,34 @@ inline std::string demangleName(char* frame)
     return oss.str();
 }
 
+    namespace detail
+    {
+
+    // or the name as it is, if it isn't a mangled one
+    inline std::string demangleSymbol(const std::string & mangled)
+    {
+        int status;
+        const char * demangled = abi::__cxa_demangle(mangled.c_str(), NULL, 0, &status);
+        ON_BLOCK_EXIT(free_ptr<char>, demangled);
+        return demangled ? demangled : mangled;
+    }
+
+    } // namespace detail
+
+// only the function of a backtrace_symbols() frame, demangled, or "[file]" if it has no symbol
+inline std::string frameFunction(const char * frame)
+{
+    const char * funcBeg = strchr(frame, '(');
+    if (funcBeg)
+    {
+        funcBeg++;
+        const std::string mangled(funcBeg, strcspn(funcBeg, "+)"));
+        if (!mangled.empty())
+            return detail::demangleSymbol(mangled);
+    }
+    return "[" + std::string(frame, funcBeg ? funcBeg - 1 - frame : strcspn(frame, " ")) + "]";
+}
+
 inline std::string formatFrame(int frameNr, char * frame)
 {
     std::ostringstream oss;
@@ -121,23 +178,501 @@ inline std::string formatFrame(int frameNr, char * frame)
     return oss.str();
 }
 
-// works best with "-O0" compiler option and "-rdynamic" linker option
-inline std::string getStackTrace(const std::string & prefix, int offset)
+    namespace detail
+    {
+
+    /**
+     * Return address -> demangleName() of its frame, for the life of the
+     * process. Readers take no lock: an entry's text is stored before its
+     * address is published and neither changes after. Misses are symbolized
+     * under a mutex, one at a time.
+     */
+    struct FrameCacheEntry
+    {
+        std::atomic<void *> address;
+        std::atomic<const char *> text;
+    };
+
+    struct FrameCache
+    {
+        static const int maxProbes = 16;
+
+        std::mutex mutex;
+        FrameCacheEntry entries[DA_STACKTRACE_CACHE_SIZE];     // zeroed with the rest of the static storage
+    };
+
+    inline FrameCache & frameCache()
+    {
+        static FrameCache s_cache;
+        return s_cache;
+    }
+
+    inline size_t frameCacheSlot(void * address, int probe)
+    {
+        return (size_t)((((uintptr_t)address >> 2) * 0x9E3779B97F4A7C15ULL >> 32) + probe) & (DA_STACKTRACE_CACHE_SIZE - 1);
+    }
+
+    // the native symbolizer's result in backtrace_symbols() format, so it goes through the same
+    // demangleName(), plus the line; backtrace_symbols() if the address isn't in a loaded ELF file
+    inline std::string symbolizeFrame(void * address)
+    {
+        SymbolInfo info;
+        if (symbolize(address, &info))
+        {
+            char offset[48];
+            snprintf(offset, sizeof(offset), "+0x%zx) [%p]", info.offset, address);
+            std::string frame = info.object + "(" + info.function + offset;
+            std::string text = demangleName(&frame[0]);
+            if (!info.file.empty())
+            {
+                snprintf(offset, sizeof(offset), ":%d", info.line);
+                text += " at " + info.file + offset;
+            }
+            return text;
+        }
+
+        char ** symbols = backtrace_symbols(&address, 1);
+        ON_BLOCK_EXIT(free_ptr<char*>, symbols);
+        return symbols ? demangleName(symbols[0]) : std::string("[unknown]");
+    }
+
+    // the text of the frame, from the cache or, if the cache is full, in scratch
+    inline const char * frameText(void * address, std::string & scratch)
+    {
+        FrameCache & cache = frameCache();
+        for (int probe = 0; probe < FrameCache::maxProbes; probe++)
+        {
+            const FrameCacheEntry & entry = cache.entries[frameCacheSlot(address, probe)];
+            void * const cached = entry.address.load(std::memory_order_acquire);
+            if (cached == address)
+                return entry.text.load(std::memory_order_relaxed);
+            if (!cached)
+                break;
+        }
+
+        std::lock_guard<std::mutex> locker(cache.mutex);
+        for (int probe = 0; probe < FrameCache::maxProbes; probe++)
+        {
+            FrameCacheEntry & entry = cache.entries[frameCacheSlot(address, probe)];
+            void * const cached = entry.address.load(std::memory_order_relaxed);
+            if (cached == address)
+                return entry.text.load(std::memory_order_relaxed);
+            if (!cached)
+            {
+                entry.text.store(strdup(symbolizeFrame(address).c_str()), std::memory_order_relaxed);
+                entry.address.store(address, std::memory_order_release);
+                return entry.text.load(std::memory_order_relaxed);
+            }
+        }
+        scratch = symbolizeFrame(address);
+        return scratch.c_str();
+    }
+
+    // the frames from first on, as getStackTrace() lines, into buf; returns the length without the '\0'
+    inline size_t formatStackTrace(char * buf, size_t size, void * const * stack, int count, const char * prefix, int first)
+    {
+        if (size == 0)
+            return 0;
+        size_t len = 0;
+        std::string scratch;
+        for (int i = first; i < count && len + 1 < size; i++)
+        {
+            const int n = snprintf(buf + len, size - len, "%sFrame %2d: %s\n", prefix, i, frameText(stack[i], scratch));
+            if (n < 0)
+                break;
+            len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+        }
+        buf[len] = '\0';
+        return len;
+    }
+
+    } // namespace detail
+
+struct EStackUnwinder
 {
-    static const int STACK_DEPTH = 32;
+    enum E
+    {
+        backtrace,          // glibc backtrace(): .eh_frame, works for any code, about a microsecond per frame
+        framePointers       // follows the frame pointer chain, nanoseconds, needs "-fno-omit-frame-pointer"
+    };
+};
 
-    void *stack[STACK_DEPTH];
-    int count = backtrace(stack, STACK_DEPTH);
+/**
+ * The unwinder of captureStack() and everything built on it. Frame pointers
+ * end the stack at the first function compiled without them (often libc) or
+ * at the edge of the thread's stack, and fall back to backtrace() where
+ * there is no DA_FRAME_POINTER_UNWINDER, the thread's stack is unknown or
+ * the walk gives fewer than 2 frames (a caller without frame pointers).
+ * GCC gives no frame to leaf functions which need no stack, even with
+ * "-fno-omit-frame-pointer"; interrupted in one (see samplingprofiler.h) the
+ * caller is missing.
+ */
+inline void setStackUnwinder(EStackUnwinder::E unwinder);
+inline EStackUnwinder::E stackUnwinder();
 
-    char **functions = backtrace_symbols(stack, count);
-    ON_BLOCK_EXIT(free_ptr<char*>, functions);
+// frames per getStackTrace(), up to DA_STACKTRACE_MAX_DEPTH, 32 by default; StackTrace keeps at most its maxFrames
+inline void setStackTraceDepth(int depth);
+inline int stackTraceDepth();
 
-    std::ostringstream oss;
+inline bool initThreadStackBounds();
+
+    namespace detail
+    {
+
+    template<typename T = void>
+    struct StackTraceState
+    {
+        static std::atomic<int> s_unwinder;
+        static std::atomic<int> s_depth;
+    };
+
+    template<typename T>
+    std::atomic<int> StackTraceState<T>::s_unwinder(DA_STACKTRACE_FRAME_POINTERS ? EStackUnwinder::framePointers : EStackUnwinder::backtrace);
+
+    template<typename T>
+    std::atomic<int> StackTraceState<T>::s_depth(32);
+
+    // the calling thread's stack, the frame pointer walk stays inside it
+    struct ThreadStackBounds
+    {
+        int state;          // 0 not looked up yet, 1 known, -1 unknown
+        uintptr_t low;
+        uintptr_t high;
+    };
+
+    inline ThreadStackBounds & threadStackBounds()
+    {
+        static thread_local ThreadStackBounds t_bounds = { 0, 0, 0 };
+        return t_bounds;
+    }
+
+    /**
+     * Return addresses from the frame record fp on, at most maxFrames.
+     * pthread_getattr_np() isn't async-signal-safe, so a signal handler
+     * passes mayLookUpBounds false. Returns -1 if the bounds aren't known.
+     */
+    inline int walkFramePointers(void ** frames, int maxFrames, void * fp, bool mayLookUpBounds)
+    {
+        ThreadStackBounds & bounds = threadStackBounds();
+        if (bounds.state == 0 && mayLookUpBounds)
+            initThreadStackBounds();
+        if (bounds.state != 1)
+            return -1;
+
+        // below the walker's own frame the stack may not be mapped
+        char here;
+        const uintptr_t low = std::max(bounds.low, (uintptr_t)&here);
+        int count = 0;
+        uintptr_t record = (uintptr_t)fp;
+        while (count < maxFrames)
+        {
+            if (record < low || record > bounds.high - 2 * sizeof(void *) || record % sizeof(void *))
+                break;
+            void * const * frame = (void * const *)record;
+            // in code without frame pointers the register holds anything: a return
+            // address is neither in the first page nor on the stack
+            const uintptr_t returnAddress = (uintptr_t)frame[1];
+            if (returnAddress < 4096 || (returnAddress >= bounds.low && returnAddress < bounds.high))
+                break;
+            frames[count++] = frame[1];
+            // the caller's record is further up the stack, anything else is not a frame record
+            if ((uintptr_t)frame[0] <= record)
+                break;
+            record = (uintptr_t)frame[0];
+        }
+        return count;
+    }
+
+    } // namespace detail
+
+inline void setStackUnwinder(EStackUnwinder::E unwinder)
+{
+    detail::StackTraceState<>::s_unwinder.store(unwinder, std::memory_order_relaxed);
+}
+
+inline EStackUnwinder::E stackUnwinder()
+{
+    return (EStackUnwinder::E)detail::StackTraceState<>::s_unwinder.load(std::memory_order_relaxed);
+}
+
+inline void setStackTraceDepth(int depth)
+{
+    detail::StackTraceState<>::s_depth.store(std::max(1, std::min(depth, DA_STACKTRACE_MAX_DEPTH)), std::memory_order_relaxed);
+}
+
+inline int stackTraceDepth()
+{
+    return detail::StackTraceState<>::s_depth.load(std::memory_order_relaxed);
+}
+
+/**
+ * Up to maxFrames return addresses with the selected unwinder, frames[0] in
+ * the caller of captureStack(). Returns their count.
+ */
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+inline int captureStack(void ** frames, int maxFrames)
+{
+    if (maxFrames <= 0)
+        return 0;
+#if DA_FRAME_POINTER_UNWINDER
+    if (stackUnwinder() == EStackUnwinder::framePointers)
+    {
+        // __builtin_frame_address() makes this function keep its frame record; a caller
+        // compiled without frame pointers ends the walk right away, then backtrace() does it
+        const int count = detail::walkFramePointers(frames, maxFrames, __builtin_frame_address(0), true);
+        if (count >= std::min(maxFrames, 2))
+            return count;
+    }
+#endif
+    // backtrace() starts in this function, one more and that one dropped
+    void * stack[DA_STACKTRACE_MAX_DEPTH + 1];
+    const int count = backtrace(stack, std::min(maxFrames, DA_STACKTRACE_MAX_DEPTH) + 1);
+    if (count <= 1)
+        return 0;
+    memcpy(frames, stack + 1, (count - 1) * sizeof(stack[0]));
+    return count - 1;
+}
+
+/**
+ * Looks up the calling thread's stack for the frame pointer unwinder. It's
+ * done by the first captureStack() of a thread anyway, but a thread which
+ * only gets unwound in signal handlers (see samplingprofiler.h) must call
+ * this first. Returns false if the stack can't be found.
+ */
+inline bool initThreadStackBounds()
+{
+    detail::ThreadStackBounds & bounds = detail::threadStackBounds();
+    if (bounds.state != 0)
+        return bounds.state == 1;
+
+    bounds.state = -1;
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        return false;
+    void * addr = 0;
+    size_t size = 0;
+    const bool ok = pthread_attr_getstack(&attr, &addr, &size) == 0 && size > 0;
+    pthread_attr_destroy(&attr);
+    if (!ok)
+        return false;
+    bounds.low = (uintptr_t)addr;
+    bounds.high = (uintptr_t)addr + size;
+    bounds.state = 1;
+    return true;
+}
+
+/**
+ * getStackTrace() into buf, truncated if it doesn't fit. Each frame is
+ * symbolized only the first time it is seen in the process, after that it is
+ * a hash lookup and a copy. Returns the length without the '\0'.
+ */
+inline size_t getStackTrace(char * buf, size_t size, const char * prefix, int offset)
+{
+    void *stack[DA_STACKTRACE_MAX_DEPTH];
+    int count = captureStack(stack, stackTraceDepth());
+    return detail::formatStackTrace(buf, size, stack, count, prefix, 1 + offset);
+}
+
+// file:line needs "-g", function names need no linker option (see symbolizer.h)
+inline std::string getStackTrace(const std::string & prefix, int offset)
+{
+    void *stack[DA_STACKTRACE_MAX_DEPTH];
+    int count = captureStack(stack, stackTraceDepth());
+
+    std::string trace;
+    std::string scratch;
+    char frameNr[24];
     for (int i = 1 + offset; i < count; i++) {
-        oss << prefix << formatFrame(i, functions[i]) << std::endl;
+        snprintf(frameNr, sizeof(frameNr), "Frame %2d: ", i);
+        trace += prefix;
+        trace += frameNr;
+        trace += detail::frameText(stack[i], scratch);
+        trace += '\n';
     }
 
-    return oss.str();
+    return trace;
+}
+
+/**
+ * A captured stack: just the return addresses and their hash, a
+ * captureStack() call and a copy. Nothing is symbolized until it is
+ * printed, then each frame goes through the same cache as getStackTrace().
+ *
+ * intern() gives identical stacks the same id, so a stack logged over and
+ * over can be printed in full once and referred to by id after that, see
+ * toLogString().
+ *
+ * Example:
+ *
+ *      const da::StackTrace trace = da::StackTrace::capture();
+ *      ...
+ *      WARNF("request failed\n%s", trace.toLogString("  ").c_str());
+ */
+class StackTrace
+{
+public:
+    static const int maxFrames = 32;
+
+    StackTrace() : m_count(0), m_hash(0) { }
+
+    // the stack of the caller, without its "offset" innermost frames
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    static StackTrace capture(int offset = 0)
+    {
+        void * stack[maxFrames + 1];
+        const int count = captureStack(stack, std::min(stackTraceDepth(), (int)maxFrames) + 1);
+        StackTrace trace;
+        for (int i = 1 + offset; i < count; i++)    // stack[0] is capture() itself
+            trace.m_frames[trace.m_count++] = stack[i];
+        trace.m_hash = hashFrames(trace.m_frames, trace.m_count);
+        return trace;
+    }
+
+    int size() const { return m_count; }
+    void * frame(int i) const { return m_frames[i]; }
+    uint64_t hash() const { return m_hash; }
+
+    bool operator==(const StackTrace & other) const
+    {
+        return m_hash == other.m_hash && m_count == other.m_count
+                && memcmp(m_frames, other.m_frames, m_count * sizeof(m_frames[0])) == 0;
+    }
+    bool operator!=(const StackTrace & other) const { return !(*this == other); }
+
+    // like getStackTrace(), frame 1 is the caller of capture()
+    std::string toString(const std::string & prefix = "") const
+    {
+        std::string trace;
+        std::string scratch;
+        char frameNr[24];
+        for (int i = 0; i < m_count; i++)
+        {
+            snprintf(frameNr, sizeof(frameNr), "Frame %2d: ", i + 1);
+            trace += prefix;
+            trace += frameNr;
+            trace += detail::frameText(m_frames[i], scratch);
+            trace += '\n';
+        }
+        return trace;
+    }
+
+    // toString() into buf, truncated if it doesn't fit; returns the length without the '\0'
+    size_t format(char * buf, size_t size, const char * prefix = "") const
+    {
+        // formatStackTrace() numbers the frames by their index, so one slot in front for frame 0
+        void * stack[maxFrames + 1];
+        stack[0] = 0;
+        memcpy(stack + 1, m_frames, m_count * sizeof(m_frames[0]));
+        return detail::formatStackTrace(buf, size, stack, m_count + 1, prefix, 1);
+    }
+
+    /**
+     * The id of this stack in a process-wide table, the same for identical
+     * stacks, never 0. Finding a known stack takes no lock. Returns 0 when
+     * the table is full. If "first" is given, it is set for the first caller
+     * which asked for it with this stack, once per id.
+     */
+    inline uint32_t intern(bool * first = 0) const;
+
+    // the stack intern() gave this id, null for an id it didn't give out
+    static inline const StackTrace * interned(uint32_t id);
+
+    /**
+     * For logging the same stack many times: "stack #<id>:" and the frames
+     * the first time, "stack #<id> (printed before)" after that.
+     */
+    std::string toLogString(const std::string & prefix = "") const
+    {
+        bool first = false;
+        const uint32_t id = intern(&first);
+        if (!id)
+            return toString(prefix);
+        char header[64];
+        snprintf(header, sizeof(header), "stack #%u%s", id, first ? ":\n" : " (printed before)");
+        return prefix + header + (first ? toString(prefix) : std::string());
+    }
+
+private:
+    static uint64_t hashFrames(void * const * frames, int count)
+    {
+        uint64_t hash = 14695981039346656037ULL;     // FNV-1a over whole addresses
+        for (int i = 0; i < count; i++)
+            hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ULL;
+        return hash;
+    }
+
+    void * m_frames[maxFrames];
+    int m_count;
+    uint64_t m_hash;
+};
+
+    namespace detail
+    {
+
+    // like the frame cache: published once, never changed or freed
+    struct StackTraceTableEntry
+    {
+        std::atomic<const StackTrace *> trace;
+        std::atomic<bool> printed;
+    };
+
+    struct StackTraceTable
+    {
+        static const int maxProbes = 32;
+
+        std::mutex mutex;
+        StackTraceTableEntry entries[DA_STACKTRACE_INTERN_SIZE];   // zeroed with the rest of the static storage
+    };
+
+    inline StackTraceTable & stackTraceTable()
+    {
+        static StackTraceTable s_table;
+        return s_table;
+    }
+
+    } // namespace detail
+
+uint32_t StackTrace::intern(bool * first) const
+{
+    detail::StackTraceTable & table = detail::stackTraceTable();
+    for (int locked = 0; locked < 2; locked++)
+    {
+        // a lookup without the lock, then again with it to insert
+        std::unique_lock<std::mutex> locker(table.mutex, std::defer_lock);
+        if (locked)
+            locker.lock();
+        for (int probe = 0; probe < detail::StackTraceTable::maxProbes; probe++)
+        {
+            const size_t slot = (size_t)(m_hash + probe) & (DA_STACKTRACE_INTERN_SIZE - 1);
+            detail::StackTraceTableEntry & entry = table.entries[slot];
+            const StackTrace * trace = entry.trace.load(std::memory_order_acquire);
+            if (!trace && locked)
+            {
+                entry.trace.store(new StackTrace(*this), std::memory_order_release);
+                trace = this;
+            }
+            if (!trace)
+                break;
+            if (*trace == *this)
+            {
+                if (first)
+                    *first = !entry.printed.exchange(true, std::memory_order_relaxed);
+                return (uint32_t)slot + 1;
+            }
+        }
+    }
+    return 0;
+}
+
+const StackTrace * StackTrace::interned(uint32_t id)
+{
+    if (id == 0 || id > DA_STACKTRACE_INTERN_SIZE)
+        return 0;
+    return detail::stackTraceTable().entries[id - 1].trace.load(std::memory_order_acquire);
 }
 
 }
@@ -0,0 +1,741 @@
+#ifndef DANADAM_SYMBOLIZER_H_GUARD
+#define DANADAM_SYMBOLIZER_H_GUARD
+
+/*
+ * Address to function and file:line, read from the ELF files themselves, so
+ * it needs neither -rdynamic nor -O0 (only -g for file:line).
+ *
+ * The loaded objects are found with dl_iterate_phdr(). Each one's file is
+ * mapped (and stays mapped) the first time an address in it is looked up;
+ * its function symbols, from .symtab or else .dynsym, go to an array sorted
+ * by address. The .debug_line programs (DWARF 2 to 5) are decoded into a
+ * sorted row table the first time a line is asked for. Lookups are binary
+ * searches. Objects loaded later are picked up when an address is not in any
+ * known one.
+ *
+ * Not supported: compressed debug sections and separate debug files
+ * (.gnu_debuglink); without them there are just no lines.
+ *
+ * Example:
+ *
+ *      da::SymbolInfo info;
+ *      if (da::symbolize(address, &info))
+ *          printf("%s+0x%zx at %s:%d\n", info.function.c_str(), info.offset, info.file.c_str(), info.line);
+ */
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__linux__) && defined(__ELF__)
+#  define DA_SYMBOLIZER 1
+#  include <algorithm>
+#  include <mutex>
+#  include <vector>
+#  include <elf.h>
+#  include <fcntl.h>
+#  include <link.h>
+#  include <string.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#else
+#  define DA_SYMBOLIZER 0
+#endif
+
+namespace da
+{
+
+struct SymbolInfo
+{
+    SymbolInfo() : offset(0), line(0) { }
+
+    std::string object;     // path of the executable or the shared object
+    std::string function;   // mangled, empty if not found
+    size_t offset;          // of the address from the start of the function
+    std::string file;       // empty if there is no line info
+    int line;
+};
+
+/**
+ * Looks address up. A return address (everything but the innermost frame of a
+ * stack) is looked up one byte back, so a call at the very end of a function
+ * isn't attributed to the next one. Returns false if the address isn't in any
+ * loaded object. Thread safe, serialized.
+ */
+inline bool symbolize(const void * address, SymbolInfo * info, bool returnAddress = true);
+
+#if DA_SYMBOLIZER
+    namespace detail
+    {
+
+    struct ElfSymbol
+    {
+        uint64_t value;
+        uint64_t size;
+        const char * name;
+
+        bool operator<(const ElfSymbol & other) const { return value < other.value; }
+    };
+
+    struct LineRow
+    {
+        uint64_t address;
+        uint32_t file;
+        uint32_t line;      // 0 for the end of a sequence
+    };
+
+    // a byte cursor over a mapped section, reads past the end give zeros and set "bad"
+    class DwarfReader
+    {
+    public:
+        DwarfReader(const char * begin, const char * end)
+            : m_pos(begin)
+            , m_end(end)
+            , m_bad(false)
+        { }
+
+        bool atEnd() const { return m_pos >= m_end; }
+        bool bad() const { return m_bad; }
+        const char * pos() const { return m_pos; }
+        size_t left() const { return m_pos < m_end ? m_end - m_pos : 0; }
+
+        void skip(uint64_t n)
+        {
+            if (n > left())
+            {
+                m_bad = true;
+                m_pos = m_end;
+            }
+            else
+                m_pos += n;
+        }
+
+        uint64_t fixed(int bytes)
+        {
+            if ((size_t)bytes > left())
+            {
+                skip(bytes);
+                return 0;
+            }
+            uint64_t value = 0;
+            for (int i = 0; i < bytes; i++)
+                value |= (uint64_t)(uint8_t)m_pos[i] << (8 * i);    // little-endian only
+            m_pos += bytes;
+            return value;
+        }
+
+        uint64_t uleb()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; ; shift += 7)
+            {
+                if (atEnd())
+                {
+                    m_bad = true;
+                    return value;
+                }
+                const uint8_t byte = *m_pos++;
+                if (shift < 64)
+                    value |= (uint64_t)(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+        }
+
+        int64_t sleb()
+        {
+            int64_t value = 0;
+            int shift = 0;
+            uint8_t byte = 0;
+            do
+            {
+                if (atEnd())
+                {
+                    m_bad = true;
+                    return value;
+                }
+                byte = *m_pos++;
+                if (shift < 64)
+                    value |= (int64_t)(byte & 0x7f) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            if (shift < 64 && (byte & 0x40))
+                value |= -((int64_t)1 << shift);
+            return value;
+        }
+
+        const char * cstr()
+        {
+            const char * s = m_pos;
+            while (m_pos < m_end && *m_pos)
+                m_pos++;
+            if (m_pos >= m_end)
+            {
+                m_bad = true;
+                return "";
+            }
+            m_pos++;
+            return s;
+        }
+
+    private:
+        const char * m_pos;
+        const char * m_end;
+        bool m_bad;
+    };
+
+    struct ElfSection
+    {
+        ElfSection() : data(0), size(0) { }
+
+        const char * data;
+        size_t size;
+    };
+
+    class ElfObject
+    {
+    public:
+        ElfObject(const std::string & path, uintptr_t bias)
+            : m_path(path)
+            , m_bias(bias)
+            , m_loaded(false)
+            , m_linesLoaded(false)
+            , m_map(0)
+            , m_mapSize(0)
+            , m_sections(0)
+            , m_sectionCount(0)
+        { }
+
+        const std::string & path() const { return m_path; }
+        uintptr_t bias() const { return m_bias; }
+
+        void addSegment(uintptr_t begin, uintptr_t end) { m_segments.push_back(std::make_pair(begin, end)); }
+
+        bool contains(uintptr_t address) const
+        {
+            for (size_t i = 0; i < m_segments.size(); i++)
+            {
+                if (address >= m_segments[i].first && address < m_segments[i].second)
+                    return true;
+            }
+            return false;
+        }
+
+        const ElfSymbol * findSymbol(uint64_t address)
+        {
+            load();
+            if (!m_map)
+                return 0;
+            std::vector<ElfSymbol>::const_iterator it = std::upper_bound(
+                    m_symbols.begin(), m_symbols.end(), ElfSymbol { address, 0, 0 });
+            if (it == m_symbols.begin())
+                return 0;
+            --it;
+            // symbols without a size (hand written assembly) are taken up to the next one
+            return !it->size || address < it->value + it->size ? &*it : 0;
+        }
+
+        const LineRow * findLine(uint64_t address)
+        {
+            load();
+            if (!m_linesLoaded)
+            {
+                m_linesLoaded = true;
+                loadLines();
+            }
+            std::vector<LineRow>::const_iterator it = std::upper_bound(
+                    m_lines.begin(), m_lines.end(), address,
+                    [](uint64_t a, const LineRow & row) { return a < row.address; });
+            if (it == m_lines.begin())
+                return 0;
+            --it;
+            return it->line ? &*it : 0;
+        }
+
+        const std::string & fileName(uint32_t index) const { return m_files[index]; }
+
+    private:
+        ElfObject(const ElfObject &);
+        ElfObject & operator=(const ElfObject &);
+
+        void load()
+        {
+            if (m_loaded)
+                return;
+            m_loaded = true;
+
+            const int fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(ElfW(Ehdr)))
+            {
+                void * map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED)
+                {
+                    m_map = (const char *)map;
+                    m_mapSize = st.st_size;
+                }
+            }
+            ::close(fd);
+            if (!m_map)
+                return;
+
+            const ElfW(Ehdr) * ehdr = (const ElfW(Ehdr) *)m_map;
+            if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32)
+                    || ehdr->e_shoff == 0 || ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) > m_mapSize)
+                return;
+            m_sections = (const ElfW(Shdr) *)(m_map + ehdr->e_shoff);
+            m_sectionCount = ehdr->e_shnum;
+            m_sectionNames = ehdr->e_shstrndx < m_sectionCount ? section(ehdr->e_shstrndx) : ElfSection();
+
+            if (!loadSymbols(SHT_SYMTAB))
+                loadSymbols(SHT_DYNSYM);
+        }
+
+        ElfSection section(size_t index) const
+        {
+            ElfSection s;
+            const ElfW(Shdr) & shdr = m_sections[index];
+            if (shdr.sh_type == SHT_NOBITS || (shdr.sh_flags & SHF_COMPRESSED) || shdr.sh_offset + shdr.sh_size > m_mapSize)
+                return s;
+            s.data = m_map + shdr.sh_offset;
+            s.size = shdr.sh_size;
+            return s;
+        }
+
+        ElfSection section(const char * name) const
+        {
+            for (size_t i = 0; i < m_sectionCount; i++)
+            {
+                if (m_sections[i].sh_name < m_sectionNames.size
+                        && strcmp(m_sectionNames.data + m_sections[i].sh_name, name) == 0)
+                    return section(i);
+            }
+            return ElfSection();
+        }
+
+        bool loadSymbols(uint32_t type)
+        {
+            for (size_t i = 0; i < m_sectionCount; i++)
+            {
+                if (m_sections[i].sh_type != type || m_sections[i].sh_link >= m_sectionCount)
+                    continue;
+                const ElfSection symbols = section(i);
+                const ElfSection names = section(m_sections[i].sh_link);
+                if (!symbols.data || !names.data)
+                    continue;
+
+                const ElfW(Sym) * sym = (const ElfW(Sym) *)symbols.data;
+                const size_t count = symbols.size / sizeof(ElfW(Sym));
+                for (size_t n = 0; n < count; n++)
+                {
+                    const int symType = ELF64_ST_TYPE(sym[n].st_info);
+                    if ((symType != STT_FUNC && symType != STT_GNU_IFUNC) || sym[n].st_shndx == SHN_UNDEF
+                            || sym[n].st_value == 0 || sym[n].st_name >= names.size)
+                        continue;
+                    const ElfSymbol s = { sym[n].st_value, sym[n].st_size, names.data + sym[n].st_name };
+                    m_symbols.push_back(s);
+                }
+            }
+            // of aliases the sized one, then the first
+            std::stable_sort(m_symbols.begin(), m_symbols.end(), [](const ElfSymbol & a, const ElfSymbol & b) {
+                return a.value < b.value || (a.value == b.value && a.size > b.size);
+            });
+            m_symbols.erase(std::unique(m_symbols.begin(), m_symbols.end(), [](const ElfSymbol & a, const ElfSymbol & b) {
+                return a.value == b.value;
+            }), m_symbols.end());
+            return !m_symbols.empty();
+        }
+
+        // DWARF forms which can be in the v5 directory and file tables
+        enum
+        {
+            DW_FORM_block = 0x09, DW_FORM_data1 = 0x0b, DW_FORM_data2 = 0x05, DW_FORM_data4 = 0x06,
+            DW_FORM_data8 = 0x07, DW_FORM_data16 = 0x1e, DW_FORM_string = 0x08, DW_FORM_strp = 0x0e,
+            DW_FORM_udata = 0x0f, DW_FORM_line_strp = 0x1f
+        };
+
+        // reads one attribute, strings into *str and numbers into *num; false for unknown forms
+        bool readForm(DwarfReader & r, uint64_t form, bool dwarf64, const char ** str, uint64_t * num) const
+        {
+            *str = 0;
+            *num = 0;
+            switch (form)
+            {
+                case DW_FORM_string:    *str = r.cstr(); return true;
+                case DW_FORM_line_strp: *str = sectionString(m_lineStr, r.fixed(dwarf64 ? 8 : 4)); return true;
+                case DW_FORM_strp:      *str = sectionString(m_str, r.fixed(dwarf64 ? 8 : 4)); return true;
+                case DW_FORM_udata:     *num = r.uleb(); return true;
+                case DW_FORM_data1:     *num = r.fixed(1); return true;
+                case DW_FORM_data2:     *num = r.fixed(2); return true;
+                case DW_FORM_data4:     *num = r.fixed(4); return true;
+                case DW_FORM_data8:     *num = r.fixed(8); return true;
+                case DW_FORM_data16:    r.skip(16); return true;
+                case DW_FORM_block:     r.skip(r.uleb()); return true;
+            }
+            return false;
+        }
+
+        static const char * sectionString(const ElfSection & s, uint64_t offset)
+        {
+            return offset < s.size && memchr(s.data + offset, 0, s.size - offset) ? s.data + offset : "";
+        }
+
+        // the v5 directory or file table: "path" and "directory index" of each entry
+        bool readEntryTable(DwarfReader & r, bool dwarf64, std::vector<std::pair<const char *, uint64_t> > & entries) const
+        {
+            const int formatCount = (int)r.fixed(1);
+            std::vector<std::pair<uint64_t, uint64_t> > format;
+            for (int i = 0; i < formatCount; i++)
+            {
+                const uint64_t contentType = r.uleb();
+                format.push_back(std::make_pair(contentType, r.uleb()));
+            }
+            const uint64_t count = r.uleb();
+            for (uint64_t n = 0; n < count && !r.bad(); n++)
+            {
+                std::pair<const char *, uint64_t> entry("", 0);
+                for (size_t f = 0; f < format.size(); f++)
+                {
+                    const char * str;
+                    uint64_t num;
+                    if (!readForm(r, format[f].second, dwarf64, &str, &num))
+                        return false;
+                    if (format[f].first == 1 && str)        // DW_LNCT_path
+                        entry.first = str;
+                    else if (format[f].first == 2)          // DW_LNCT_directory_index
+                        entry.second = num;
+                }
+                entries.push_back(entry);
+            }
+            return !r.bad();
+        }
+
+        static std::string joinPath(const char * dir, const char * name)
+        {
+            if (name[0] == '/' || !dir || !dir[0])
+                return name;
+            return std::string(dir) + "/" + name;
+        }
+
+        void loadLines()
+        {
+            // the vdso, a deleted or an unreadable file: nothing mapped
+            if (!m_map)
+                return;
+            const ElfSection lines = section(".debug_line");
+            m_lineStr = section(".debug_line_str");
+            m_str = section(".debug_str");
+            if (!lines.data)
+                return;
+
+            DwarfReader units(lines.data, lines.data + lines.size);
+            while (!units.atEnd() && !units.bad())
+            {
+                uint64_t length = units.fixed(4);
+                const bool dwarf64 = length == 0xffffffff;
+                if (dwarf64)
+                    length = units.fixed(8);
+                if (length > units.left())
+                    return;
+                DwarfReader unit(units.pos(), units.pos() + length);
+                units.skip(length);
+                loadLineUnit(unit, dwarf64);
+            }
+
+            std::stable_sort(m_lines.begin(), m_lines.end(), [](const LineRow & a, const LineRow & b) {
+                // the end of one sequence before a row of the next at the same address
+                return a.address < b.address || (a.address == b.address && a.line == 0 && b.line != 0);
+            });
+        }
+
+        void loadLineUnit(DwarfReader & r, bool dwarf64)
+        {
+            const int version = (int)r.fixed(2);
+            if (version < 2 || version > 5)
+                return;
+            if (version >= 5)
+                r.skip(2);      // address size, segment selector size
+            const uint64_t headerLength = r.fixed(dwarf64 ? 8 : 4);
+            DwarfReader program(r.pos() + (headerLength < r.left() ? headerLength : r.left()), r.pos() + r.left());
+
+            const int minInstructionLength = (int)r.fixed(1);
+            if (version >= 4)
+                r.skip(1);      // maximum operations per instruction, VLIW only
+            r.skip(1);          // default is_stmt, all rows are kept
+            const int lineBase = (int8_t)r.fixed(1);
+            const int lineRange = (int)r.fixed(1);
+            const int opcodeBase = (int)r.fixed(1);
+            if (lineRange == 0)
+                return;
+            std::vector<int> opcodeLengths(opcodeBase > 0 ? opcodeBase : 1, 0);
+            for (int i = 1; i < opcodeBase; i++)
+                opcodeLengths[i] = (int)r.fixed(1);
+
+            // unit file index -> m_files index
+            std::vector<uint32_t> files;
+            if (version >= 5)
+            {
+                std::vector<std::pair<const char *, uint64_t> > dirs, names;
+                if (!readEntryTable(r, dwarf64, dirs) || !readEntryTable(r, dwarf64, names))
+                    return;
+                for (size_t i = 0; i < names.size(); i++)
+                {
+                    files.push_back((uint32_t)m_files.size());
+                    m_files.push_back(joinPath(names[i].second < dirs.size() ? dirs[names[i].second].first : 0, names[i].first));
+                }
+            }
+            else
+            {
+                std::vector<const char *> dirs(1, (const char *)0);    // 0 is the compilation directory, not listed
+                while (!r.bad())
+                {
+                    const char * dir = r.cstr();
+                    if (!dir[0])
+                        break;
+                    dirs.push_back(dir);
+                }
+                files.push_back(0);     // numbered from 1
+                m_files.resize(m_files.empty() ? 1 : m_files.size());
+                while (!r.bad())
+                {
+                    const char * name = r.cstr();
+                    if (!name[0])
+                        break;
+                    const uint64_t dir = r.uleb();
+                    r.uleb();   // modification time
+                    r.uleb();   // length
+                    files.push_back((uint32_t)m_files.size());
+                    m_files.push_back(joinPath(dir < dirs.size() ? dirs[dir] : 0, name));
+                }
+            }
+            if (r.bad())
+                return;
+            if (m_files.empty())
+                m_files.push_back("");
+
+            uint64_t address = 0;
+            uint64_t file = 1;
+            int64_t line = 1;
+            size_t sequenceBegin = m_lines.size();
+            while (!program.atEnd() && !program.bad())
+            {
+                const int opcode = (int)program.fixed(1);
+                if (opcode >= opcodeBase)
+                {
+                    const int adjusted = opcode - opcodeBase;
+                    address += (uint64_t)(adjusted / lineRange) * minInstructionLength;
+                    line += lineBase + adjusted % lineRange;
+                    addRow(sequenceBegin, address, files, file, line);
+                    continue;
+                }
+                switch (opcode)
+                {
+                    case 0:     // extended
+                    {
+                        const uint64_t len = program.uleb();
+                        if (len == 0 || len > program.left())
+                            return;
+                        DwarfReader ext(program.pos(), program.pos() + len);
+                        program.skip(len);
+                        switch ((int)ext.fixed(1))
+                        {
+                            case 1:     // end_sequence
+                                addRow(sequenceBegin, address, files, file, 0);
+                                sequenceBegin = m_lines.size();
+                                address = 0;
+                                file = 1;
+                                line = 1;
+                                break;
+                            case 2:     // set_address
+                                address = ext.fixed((int)(len - 1 < 8 ? len - 1 : 8));
+                                break;
+                        }
+                        break;
+                    }
+                    case 1:             // copy
+                        addRow(sequenceBegin, address, files, file, line);
+                        break;
+                    case 2:             // advance_pc
+                        address += program.uleb() * minInstructionLength;
+                        break;
+                    case 3:             // advance_line
+                        line += program.sleb();
+                        break;
+                    case 4:             // set_file
+                        file = program.uleb();
+                        break;
+                    case 8:             // const_add_pc
+                        address += (uint64_t)((255 - opcodeBase) / lineRange) * minInstructionLength;
+                        break;
+                    case 9:             // fixed_advance_pc
+                        address += program.fixed(2);
+                        break;
+                    default:            // the ones which don't change address, file or line
+                        for (int i = 0; i < opcodeLengths[opcode]; i++)
+                            program.uleb();
+                        break;
+                }
+            }
+        }
+
+        // a row replaces the one before it at the same address, so a sequence has no empty ranges
+        // and the only rows at one address are the end of a sequence and the start of another
+        void addRow(size_t sequenceBegin, uint64_t address, const std::vector<uint32_t> & files, uint64_t file, int64_t line)
+        {
+            if (m_lines.size() > sequenceBegin && m_lines.back().address == address)
+                m_lines.pop_back();
+            const LineRow row = {
+                address,
+                file < files.size() ? files[file] : 0,
+                line > 0 ? (uint32_t)line : (line == 0 ? 0 : 1)
+            };
+            m_lines.push_back(row);
+        }
+
+        const std::string m_path;
+        const uintptr_t m_bias;
+        std::vector<std::pair<uintptr_t, uintptr_t> > m_segments;     // executable PT_LOADs, runtime addresses
+        bool m_loaded;
+        bool m_linesLoaded;
+
+        const char * m_map;                 // the whole file, never unmapped, the names point into it
+        size_t m_mapSize;
+        const ElfW(Shdr) * m_sections;
+        size_t m_sectionCount;
+        ElfSection m_sectionNames;
+        ElfSection m_lineStr;
+        ElfSection m_str;
+
+        std::vector<ElfSymbol> m_symbols;
+        std::vector<LineRow> m_lines;
+        std::vector<std::string> m_files;
+    };
+
+    class Symbolizer
+    {
+    public:
+        Symbolizer() : m_sawExecutable(false) { }
+        ~Symbolizer()
+        {
+            for (size_t i = 0; i < m_objects.size(); i++)
+                delete m_objects[i];
+        }
+
+        bool symbolize(uintptr_t address, SymbolInfo * info, bool returnAddress)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            const uintptr_t lookup = returnAddress && address ? address - 1 : address;
+            ElfObject * object = findObject(lookup);
+            if (!object)
+            {
+                scanObjects();      // maybe dlopen()ed since
+                object = findObject(lookup);
+            }
+            if (!object)
+                return false;
+
+            info->object = object->path();
+            info->function.clear();
+            info->offset = address - object->bias();
+            info->file.clear();
+            info->line = 0;
+            const uint64_t relative = lookup - object->bias();
+            if (const ElfSymbol * symbol = object->findSymbol(relative))
+            {
+                info->function = symbol->name;
+                info->offset = address - object->bias() - symbol->value;
+            }
+            if (const LineRow * row = object->findLine(relative))
+            {
+                info->file = object->fileName(row->file);
+                info->line = (int)row->line;
+            }
+            return true;
+        }
+
+    private:
+        Symbolizer(const Symbolizer &);
+        Symbolizer & operator=(const Symbolizer &);
+
+        ElfObject * findObject(uintptr_t address) const
+        {
+            for (size_t i = 0; i < m_objects.size(); i++)
+            {
+                if (m_objects[i]->contains(address))
+                    return m_objects[i];
+            }
+            return 0;
+        }
+
+        void scanObjects()
+        {
+            dl_iterate_phdr(&Symbolizer::addObject, this);
+        }
+
+        static int addObject(struct dl_phdr_info * info, size_t, void * data)
+        {
+            Symbolizer * self = (Symbolizer *)data;
+            std::string path = info->dlpi_name ? info->dlpi_name : "";
+            if (path.empty())
+            {
+                // the executable comes first, a nameless one after it has no file
+                if (self->m_sawExecutable)
+                    return 0;
+                self->m_sawExecutable = true;
+                path = executablePath();
+            }
+            for (size_t i = 0; i < self->m_objects.size(); i++)
+            {
+                if (self->m_objects[i]->path() == path && self->m_objects[i]->bias() == info->dlpi_addr)
+                    return 0;
+            }
+
+            ElfObject * object = new ElfObject(path, info->dlpi_addr);
+            for (int i = 0; i < info->dlpi_phnum; i++)
+            {
+                const ElfW(Phdr) & phdr = info->dlpi_phdr[i];
+                if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X))
+                    object->addSegment(info->dlpi_addr + phdr.p_vaddr, info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz);
+            }
+            self->m_objects.push_back(object);
+            return 0;
+        }
+
+        static std::string executablePath()
+        {
+            char buf[4096];
+            const ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+            return len > 0 ? std::string(buf, len) : std::string("/proc/self/exe");
+        }
+
+        std::mutex m_mutex;
+        std::vector<ElfObject *> m_objects;
+        bool m_sawExecutable;
+    };
+
+    inline Symbolizer & symbolizer()
+    {
+        static Symbolizer s_symbolizer;
+        return s_symbolizer;
+    }
+
+    } // namespace detail
+
+inline bool symbolize(const void * address, SymbolInfo * info, bool returnAddress)
+{
+    return detail::symbolizer().symbolize((uintptr_t)address, info, returnAddress);
+}
+#else
+inline bool symbolize(const void *, SymbolInfo *, bool)
+{
+    return false;
+}
+#endif
+
+} // namespace
+
+#endif
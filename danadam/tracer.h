@@ -0,0 +1,295 @@
+#ifndef DANADAM_TRACER_H_GUARD
+#define DANADAM_TRACER_H_GUARD
+
+/*
+ * Timeline of timed scopes, written as Chrome trace-event JSON (loads in
+ * chrome://tracing and in Perfetto). POSIX only.
+ *
+ * Between da::startTracing() and da::stopTracing() every DA_PROFILE_SCOPE (see
+ * profiler.h) also adds a "complete" event (name, CLOCK_MONOTONIC start,
+ * duration) to a ring buffer of its thread. A buffer is allocated on the
+ * first event of a thread after startTracing(), adding an event is a few
+ * relaxed stores and a release store of the head. When a buffer is full the
+ * oldest events are overwritten, so the trace covers the last
+ * eventsPerThread events of each thread.
+ *
+ * da::writeTrace() reads the buffers without stopping the threads; events
+ * being overwritten while it reads are left out. The buffers of finished
+ * threads are kept until the next startTracing().
+ *
+ * Example:
+ *
+ *      da::startTracing(1 << 20);      // 24 MiB per thread
+ *      sleep(5);
+ *      da::stopTracing();
+ *      da::writeTrace("/tmp/myprog.trace.json");
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stringutils.h"
+
+namespace da
+{
+
+inline void startTracing(size_t eventsPerThread = 64 * 1024);
+inline void stopTracing();
+inline bool writeTrace(const char * path);
+
+    namespace detail
+    {
+
+    inline uint64_t traceNowNs()
+    {
+        struct timespec ts = { 0, 0 };
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+    }
+
+    // fields are atomic only so writeTrace() may read one being overwritten, the stores are plain movs
+    struct TraceEvent
+    {
+        std::atomic<const char *> name;
+        std::atomic<uint64_t> startNs;
+        std::atomic<uint64_t> durationNs;
+    };
+
+    // the generation of the current tracing session, 0 while tracing is off
+    template<typename T = void>
+    struct TraceState
+    {
+        static std::atomic<unsigned> s_generation;
+    };
+
+    template<typename T>
+    std::atomic<unsigned> TraceState<T>::s_generation(0);
+
+    inline bool isTracing()
+    {
+        return TraceState<>::s_generation.load(std::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * Events of one thread. Only the owning thread writes, writeTrace()
+     * reads; the events are valid between "head - capacity" and "head",
+     * except the one "claimed" is ahead of head while it's being overwritten.
+     */
+    class TraceBuffer
+    {
+    public:
+        TraceBuffer()
+            : m_generation(0)
+            , m_capacity(0)
+            , m_claimed(0)
+            , m_head(0)
+            , m_tid((long)syscall(SYS_gettid))
+        {
+            char name[64] = { 0 };
+#if defined(__linux__)
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+#endif
+            m_threadName = name;
+        }
+
+        // owner only
+        void append(const char * name, uint64_t startNs, uint64_t durationNs)
+        {
+            const unsigned generation = TraceState<>::s_generation.load(std::memory_order_acquire);
+            if (!generation)
+                return;
+            if (m_generation.load(std::memory_order_relaxed) != generation)
+                restart(generation);
+
+            const uint64_t head = m_head.load(std::memory_order_relaxed);
+            m_claimed.store(head + 1, std::memory_order_relaxed);
+            // pairs with the fence in writeEvents(): a reader seeing any of the stores below sees the claim
+            std::atomic_thread_fence(std::memory_order_release);
+            TraceEvent & event = m_events[head & (m_capacity - 1)];
+            event.name.store(name, std::memory_order_relaxed);
+            event.startNs.store(startNs, std::memory_order_relaxed);
+            event.durationNs.store(durationNs, std::memory_order_relaxed);
+            m_head.store(head + 1, std::memory_order_release);
+        }
+
+        // with the registry mutex locked, so no new session starts meanwhile
+        void writeEvents(FILE * out, unsigned generation, int pid, bool * first) const
+        {
+            if (m_generation.load(std::memory_order_acquire) != generation)
+                return;
+
+            const uint64_t head = m_head.load(std::memory_order_acquire);
+            const uint64_t begin = head > m_capacity ? head - m_capacity : 0;
+            struct Copy { const char * name; uint64_t startNs; uint64_t durationNs; };
+            std::vector<Copy> copies;
+            copies.reserve(head - begin);
+            for (uint64_t i = begin; i < head; i++)
+            {
+                const TraceEvent & event = m_events[i & (m_capacity - 1)];
+                const Copy copy = {
+                    event.name.load(std::memory_order_relaxed),
+                    event.startNs.load(std::memory_order_relaxed),
+                    event.durationNs.load(std::memory_order_relaxed)
+                };
+                copies.push_back(copy);
+            }
+            // the ones the owner started to overwrite while we copied are not valid
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t claimed = m_claimed.load(std::memory_order_relaxed);
+            const uint64_t validBegin = claimed > m_capacity ? claimed - m_capacity : 0;
+
+            fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                    *first ? "" : ",\n", pid, m_tid, escapeString(m_threadName, "\"", '\\').c_str());
+            *first = false;
+            for (uint64_t i = begin > validBegin ? begin : validBegin; i < head; i++)
+            {
+                const Copy & copy = copies[i - begin];
+                fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld}",
+                        escapeString(copy.name ? copy.name : "", "\"", '\\').c_str(),
+                        copy.startNs / 1e3, copy.durationNs / 1e3, pid, m_tid);
+            }
+        }
+
+    private:
+        TraceBuffer(const TraceBuffer &);
+        TraceBuffer & operator=(const TraceBuffer &);
+
+        inline void restart(unsigned generation);
+
+        std::atomic<unsigned> m_generation;     // of the session the events are from
+        size_t m_capacity;                      // a power of 2
+        std::atomic<uint64_t> m_claimed;        // events whose slot the owner started to write
+        std::atomic<uint64_t> m_head;           // events appended so far
+        std::unique_ptr<TraceEvent[]> m_events;
+        const long m_tid;
+        std::string m_threadName;
+    };
+
+    struct TraceRegistry
+    {
+        TraceRegistry() : generation(0), eventsPerThread(0) { }
+
+        std::mutex mutex;
+        unsigned generation;            // of the last session, running or stopped
+        size_t eventsPerThread;
+        std::vector<std::shared_ptr<TraceBuffer> > buffers;     // also of the finished threads
+    };
+
+    inline TraceRegistry & traceRegistry()
+    {
+        static TraceRegistry s_registry;
+        return s_registry;
+    }
+
+    inline TraceBuffer & threadTraceBuffer()
+    {
+        static thread_local std::shared_ptr<TraceBuffer> t_buffer;
+        if (!t_buffer)
+        {
+            t_buffer = std::make_shared<TraceBuffer>();
+            TraceRegistry & registry = traceRegistry();
+            std::lock_guard<std::mutex> locker(registry.mutex);
+            registry.buffers.push_back(t_buffer);
+        }
+        return *t_buffer;
+    }
+
+    // a new session: reallocates if the size changed, otherwise just forgets the old events
+    void TraceBuffer::restart(unsigned generation)
+    {
+        size_t capacity;
+        {
+            TraceRegistry & registry = traceRegistry();
+            std::lock_guard<std::mutex> locker(registry.mutex);
+            capacity = registry.eventsPerThread;
+        }
+        // writeTrace() only reads buffers of the current generation, this one isn't yet
+        if (capacity != m_capacity || !m_events)
+        {
+            m_events.reset(new TraceEvent[capacity]);
+            m_capacity = capacity;
+        }
+        m_claimed.store(0, std::memory_order_relaxed);
+        m_head.store(0, std::memory_order_relaxed);
+        m_generation.store(generation, std::memory_order_release);
+    }
+
+    inline void traceEvent(const char * name, uint64_t startNs, uint64_t durationNs)
+    {
+        threadTraceBuffer().append(name, startNs, durationNs);
+    }
+
+    } // namespace detail
+
+/**
+ * Starts a new tracing session, the events of the previous one are dropped.
+ *
+ * eventsPerThread - Ring buffer size of each thread, rounded up to a power of 2,
+ *                   an event takes 24 bytes.
+ */
+inline void startTracing(size_t eventsPerThread)
+{
+    size_t size = 1;
+    while (size < eventsPerThread)
+        size <<= 1;
+
+    detail::TraceRegistry & registry = detail::traceRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+    registry.eventsPerThread = size;
+
+    // buffers of finished threads are only referenced from here
+    std::vector<std::shared_ptr<detail::TraceBuffer> > & buffers = registry.buffers;
+    for (size_t i = buffers.size(); i-- > 0; )
+    {
+        if (buffers[i].use_count() == 1)
+            buffers.erase(buffers.begin() + i);
+    }
+
+    if (++registry.generation == 0)
+        ++registry.generation;
+    detail::TraceState<>::s_generation.store(registry.generation, std::memory_order_release);
+}
+
+/**
+ * Stops adding events. They stay in the buffers for writeTrace().
+ */
+inline void stopTracing()
+{
+    detail::TraceState<>::s_generation.store(0, std::memory_order_release);
+}
+
+/**
+ * Writes the events of the last session as Chrome trace-event JSON. It may be
+ * called while tracing, but not concurrently with startTracing(). Returns
+ * false if the file can't be written.
+ */
+inline bool writeTrace(const char * path)
+{
+    FILE * out = fopen(path, "w");
+    if (!out)
+        return false;
+
+    detail::TraceRegistry & registry = detail::traceRegistry();
+    std::lock_guard<std::mutex> locker(registry.mutex);
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    const int pid = getpid();
+    for (size_t i = 0; i < registry.buffers.size(); i++)
+        registry.buffers[i]->writeEvents(out, registry.generation, pid, &first);
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0;
+}
+
+} // namespace
+
+#endif
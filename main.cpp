@@ -1,15 +1,38 @@
 #include "loggerf.h"
+#include "loggerbin.h"
 #include "loggerqt.h"
 
+#include <chrono>
+#include <functional>
 #include <list>
 #include <map>
+#include <thread>
 
+#include <fcntl.h>
+#include <sys/auxv.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "hex.h"
 #include "itoa.h"
 #include "stringutils.h"
 #include "emailvalidator.h"
 #include "stringenum.h"
 #include "daalgorithm.h"
 #include "dafunctional.h"
+#include "dabench.h"
+#include "latencyhistogram.h"
+#define DA_ALLOCPROFILER_DEFINE_OPERATORS      // in this one file only
+#include "allocprofiler.h"
+#include "metrics.h"
+#include "perfcounters.h"
+#include "profiler.h"
+#include "samplingprofiler.h"
+#include "crashhandler.h"
+#include "stacktrace.h"
+#include "symbolizer.h"
 
 INIT_LOGGER();
 
@@ -47,6 +70,12 @@ void test_loggerf()
     TRACEF("Message with datetime and level and place");
 }
 
+int nestedLog()
+{
+    LOG(da::ELogLevel::trace) << "Nested message";
+    return 7;
+}
+
 void test_loggerqt()
 {
     TRACE("%1(): --------------------------------").arg(__func__);
@@ -60,6 +89,8 @@ void test_loggerqt()
 
     TRACE("Plain message, without arguments");
     TRACE("Message with arguments: %1 - %2").arg(str).arg(i);
+    LOG(da::ELogLevel::trace) << "Streamed message: " << str << " - " << i << ", " << 2.5 << ", " << QString("qstring") << ", " << QByteArray("bytes");
+    LOG(da::ELogLevel::trace) << "Streamed message with nested log: " << nestedLog();
     TRACE("  * Let's increase log level to info");
     setLogLevel(da::ELogLevel::info);
     TRACE("!!! This shouldn't be displayed !!!");
@@ -80,6 +111,818 @@ void test_loggerqt()
     TRACE("Message with datetime and level and place");
 }
 
+void test_loggerf_async()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    da::startAsyncLogging(da::EOverflowPolicy::block, 16);
+    for (int i = 0; i < 3; i++)
+        TRACEF("Async message %d", i);
+    da::flushLogs();
+    TRACEF("Async message after flush");
+    da::stopAsyncLogging();
+    TRACEF("Synchronous message again");
+}
+
+void test_loggerf_asyncFlush()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // stdout goes to a pipe read slowly, so the background thread blocks in write()
+    int fds[2];
+    const int savedStdout = dup(STDOUT_FILENO);
+    if (pipe(fds) != 0 || savedStdout < 0 || dup2(fds[1], STDOUT_FILENO) < 0)
+    {
+        WARNF("failed to redirect stdout to a pipe");
+        return;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    std::mutex readMutex;
+    int lines = 0;
+    bool closed = false;
+    std::thread reader([&]() {
+        char buf[1024];
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            std::lock_guard<std::mutex> locker(readMutex);
+            const ssize_t len = read(fds[0], buf, sizeof(buf));
+            lines += std::count(buf, buf + (len > 0 ? len : 0), '\n');
+            if (len == 0 || closed)
+                break;
+        }
+    });
+
+    const int messages = 20000;
+    // the queue fits in one write(), which the pipe can't take at once
+    da::startAsyncLogging(da::EOverflowPolicy::block, 512);
+    for (int i = 0; i < messages; i++)
+        TRACEF("Flushed message %d", i);
+    da::flushLogs();
+
+    // what the reader got plus what is in the pipe right now is everything written so far
+    int written = 0;
+    {
+        std::lock_guard<std::mutex> locker(readMutex);
+        int pending = 0;
+        ioctl(fds[0], FIONREAD, &pending);
+        std::vector<char> buf(pending);
+        for (ssize_t len; pending > 0 && (len = read(fds[0], &buf[0], pending)) > 0; pending -= len)
+            lines += std::count(buf.begin(), buf.begin() + len, '\n');
+        written = lines;
+        closed = true;
+    }
+    reader.join();
+
+    da::stopAsyncLogging();
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    close(fds[1]);
+    close(fds[0]);
+    if (written != messages)
+        WARNF("%d of %d lines written when flushLogs() returned", written, messages);
+}
+
+void test_loggerf_asyncRestart()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // a thread logs through a tiny queue while the backend stops and starts, no line may be lost or stuck
+    int fds[2];
+    const int savedStdout = dup(STDOUT_FILENO);
+    if (pipe(fds) != 0 || savedStdout < 0 || dup2(fds[1], STDOUT_FILENO) < 0)
+    {
+        WARNF("failed to redirect stdout to a pipe");
+        return;
+    }
+    close(fds[1]);
+    int lines = 0;
+    std::thread reader([&]() {
+        char buf[4096];
+        ssize_t len;
+        while ((len = read(fds[0], buf, sizeof(buf))) > 0)
+            lines += std::count(buf, buf + len, '\n');
+    });
+
+    const int messages = 20000;
+    std::atomic<bool> done(false);
+    da::startAsyncLogging(da::EOverflowPolicy::block, 2);
+    std::thread logger([&]() {
+        for (int i = 0; i < messages; i++)
+            TRACEF("Restart message %d", i);
+        done = true;
+    });
+    while (!done)
+    {
+        da::stopAsyncLogging();
+        da::startAsyncLogging(da::EOverflowPolicy::block, 2);
+    }
+    logger.join();
+    da::stopAsyncLogging();
+
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    reader.join();
+    close(fds[0]);
+    if (lines != messages)
+        WARNF("%d of %d lines written", lines, messages);
+}
+
+void test_loggerf_asyncThreadExit()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // queues of threads which exited are freed by the background thread once drained
+    da::startAsyncLogging(da::EOverflowPolicy::block, 16);
+    TRACEF("Message from the main thread");
+    for (int i = 0; i < 8; i++)
+        std::thread([]() { TRACEF("Message from a short-lived thread"); }).join();
+    da::flushLogs();
+
+    size_t queues = 0;
+    for (int i = 0; i < 100 && (queues = da::detail::asyncLogger().queueCount()) > 1; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    da::stopAsyncLogging();
+    if (queues != 1)
+        WARNF("%zu queues still registered, expected only the main thread's", queues);
+}
+
+// Returns what fn() wrote to stdout.
+std::string capturedStdout(const std::function<void()> & fn)
+{
+    int fds[2];
+    const int savedStdout = dup(STDOUT_FILENO);
+    if (pipe(fds) != 0 || savedStdout < 0 || dup2(fds[1], STDOUT_FILENO) < 0)
+    {
+        WARNF("failed to redirect stdout to a pipe");
+        return std::string();
+    }
+    close(fds[1]);
+    std::string out;
+    std::thread reader([&]() {
+        char buf[4096];
+        ssize_t len;
+        while ((len = read(fds[0], buf, sizeof(buf))) > 0)
+            out.append(buf, len);
+    });
+
+    fn();
+    da::flushLogs();
+
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    reader.join();
+    close(fds[0]);
+    return out;
+}
+
+void test_loggerf_asyncFormat()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // the background thread formats captured arguments, lines must come out as if formatted right away
+    char name[16];
+    const auto logAll = [&]() {
+        strcpy(name, "original");
+        TRACEF("ints %d %5i %-5d| %+d %ld %lld %u %x %#o %hhu %c", -1, 42, 7, 3, -123456789L, 1LL << 40, 3000000000u, 255, 8, 300, 'z');
+        TRACEF("floats %.3f %e %g %10.2f", 3.14159, 1e-10, 0.5f, -2.5);
+        TRACEF("strings %s %10s %.3s %-*s| %s", name, "right", "truncated", 6, "left", (const char *)0);
+        TRACEF("pointers %p %p, percent %%", (void *)name, nullptr);
+        strcpy(name, "changed");    // copied already
+        TRACEF("no arguments");
+    };
+
+    const da::LogFormat format = da::logConfig().format;
+    da::setLogFormat(false, true, true);
+    const std::string sync = capturedStdout(logAll);
+    da::startAsyncLogging(da::EOverflowPolicy::block, 16);
+    const std::string async = capturedStdout(logAll);
+    if (async != sync)
+        WARNF("async lines differ:\n%s-- from the synchronous ones:\n%s", async.c_str(), sync.c_str());
+
+    // arguments which don't fit a record are formatted by the caller (and truncated)
+    const std::string big(DA_LOG_ASYNC_MSG_SIZE, 'x');
+    const std::string truncated = capturedStdout([&]() { TRACEF("%s", big.c_str()); });
+    if (truncated.size() < 4 || truncated.compare(truncated.size() - 4, 4, "...\n") != 0)
+        WARNF("long async line not truncated: %s", truncated.c_str());
+
+    // the raw timestamp is formatted by the background thread
+    da::setLogFormat(true, false, false);
+    const std::string dated = capturedStdout([]() { TRACEF("dated"); });
+    if (dated.size() != 32 || dated[4] != '-' || dated[19] != ',' || dated.compare(23, 9, " - dated\n") != 0)
+        WARNF("unexpected async datetime: %s", dated.c_str());
+    da::stopAsyncLogging();
+    da::setLogFormat(format.datetime, format.logLevel, format.place);
+}
+
+void test_loggerf_batching()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    da::setLogBatching(4096, 10);
+    for (int i = 0; i < 3; i++)
+        TRACEF("Batched message %d", i);
+    da::flushLogs();
+    TRACEF("Batched message after flush");
+    da::setLogBatching(0);
+    TRACEF("Unbatched message again");
+}
+
+void test_loggerf_limit()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    for (int i = 0; i < 10; i++)
+        LOGF_EVERY_N(da::ELogLevel::trace, 4, "Every 4th message: %d", i);
+    for (int i = 0; i < 10; i++)
+        LOGF_FIRST_N(da::ELogLevel::trace, 2, "First 2 messages: %d", i);
+    for (int i = 0; i < 10; i++)
+        LOGF_RATE(da::ELogLevel::trace, 3, "At most 3 messages a second: %d", i);
+}
+
+void test_loggerf_file()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    const char path[] = "danadam_test.log";
+    const char segment[] = "danadam_test.log.000000";
+    if (!da::openLogFile(path, 64 * 1024))
+    {
+        WARNF("failed to open %s", path);
+        return;
+    }
+    da::setLogFormat(false, true, true);
+    TRACEF("File message %d", 1);
+    INFOF("File message %d", 2);
+    da::setLogFormat(true, true, true);
+    da::closeLogFile();
+
+    TRACEF("  * Read back from %s:", segment);
+    FILE * in = fopen(segment, "r");
+    char line[256];
+    while (in && fgets(line, sizeof(line), in))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        TRACEF("    %s", line);
+    }
+    if (in)
+        fclose(in);
+    else
+        WARNF("failed to read %s", segment);
+    remove(segment);
+}
+
+void test_loggerf_rules()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    TRACEF("  * Let's turn main.cpp to error level");
+    if (!da::setLogRules("main.cpp:error"))
+        WARNF("failed to parse the rules");
+    TRACEF("!!! This shouldn't be displayed !!!");
+    ERRORF("  *** This should still be displayed, let's turn on trace for this line only");
+    char rules[64];
+    snprintf(rules, sizeof(rules), "main.cpp:error, main.cpp:%d:trace", __LINE__ + 2);
+    da::setLogRules(rules);
+    TRACEF("***** This should be displayed");
+    TRACEF("!!! This shouldn't be displayed !!!");
+    if (da::setLogRules("main.cpp:bogus"))
+        WARNF("invalid rules were accepted");
+    da::setLogRules("");
+    TRACEF("Back to the global level");
+}
+
+void test_loggerf_config()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    const char path[] = "danadam_test.conf";
+    FILE * out = fopen(path, "w");
+    fputs("# test config\nformat = level place\nmain.cpp = warn\n", out);
+    fclose(out);
+    if (!da::watchLogConfig(path))
+    {
+        WARNF("failed to watch %s", path);
+        return;
+    }
+    TRACEF("!!! This shouldn't be displayed !!!");
+    WARNF("  * This should be displayed without datetime");
+
+    out = fopen(path, "w");
+    fputs("format = datetime level place\n", out);
+    fclose(out);
+    for (int i = 0; i < 100 && da::logConfig().rules.size() > 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    TRACEF("  * This should be displayed after the reload");
+    da::unwatchLogConfig();
+
+    out = fopen(path, "w");
+    fputs("level = bogus\n", out);
+    fclose(out);
+    if (da::loadLogConfig(path))
+        WARNF("invalid config was accepted");
+
+    out = fopen(path, "w");
+    fputs("level = off\n", out);
+    fclose(out);
+    const da::ELogLevel::E level = da::logConfig().logLevel;
+    if (!da::loadLogConfig(path) || da::logConfig().logLevel != da::ELogLevel::off)
+        WARNF("level = off not applied");
+    da::setLogLevel(level);
+    remove(path);
+
+    // a snapshot stays valid after any number of changes, going back and forth reuses the snapshots
+    const da::LogConfig & held = da::logConfig();
+    const size_t heldRules = held.rules.size();
+    const size_t snapshots = da::detail::logConfigSnapshots().size();
+    for (int i = 0; i < 1000; i++)
+        da::setLogRules(i % 2 ? "" : "main.cpp:info");
+    da::setLogRules("");
+    if (da::detail::logConfigSnapshots().size() > snapshots + 2)
+        WARNF("%d config snapshots added for 2 configs", (int)(da::detail::logConfigSnapshots().size() - snapshots));
+    if (&da::logConfig() != &held || held.rules.size() != heldRules)
+        WARNF("the same config wasn't reused");
+}
+
+void profiledWork(int n)
+{
+    DA_PROFILE_SCOPE("profiledWork");
+    volatile int sink = 0;
+    for (int i = 0; i < n; i++)
+    {
+        DA_PROFILE_SCOPE("profiledWork inner");
+        sink += i;
+    }
+}
+
+void test_profiler()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    std::thread other(profiledWork, 10);
+    profiledWork(5);
+    other.join();
+
+    const std::vector<da::ProfileZoneReport> report = da::profileReport();
+    for (size_t i = 0; i < report.size(); i++)
+    {
+        const da::ProfileZoneReport & r = report[i];
+        TRACEF("  %s: %llu calls", r.name, (unsigned long long)r.count);
+        if (r.minNs > r.maxNs || r.totalNs < r.maxNs)
+            WARNF("inconsistent times for %s", r.name);
+    }
+    if (report.size() != 2)
+        WARNF("expected 2 zones, got %d", (int)report.size());
+}
+
+void test_perfCounters()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    da::PerfCounterValues before, after;
+    const bool available = da::readPerfCounters(&before);
+    profiledWork(100);
+    da::readPerfCounters(&after);
+    if (!available)
+        TRACEF("  no counters: %s", da::perfCountersError().c_str());
+    else if (after.has(da::EPerfCounter::instructions) && after.delta(before, da::EPerfCounter::instructions) == 0)
+        WARNF("no instructions counted");
+
+    da::setProfileCounters(true);
+    profiledWork(3);
+    da::setProfileCounters(false);
+    const std::vector<da::ProfileZoneReport> report = da::profileReport();
+    for (size_t i = 0; i < report.size(); i++)
+    {
+        if (available != (report[i].countedCalls > 0))
+            WARNF("%s: %llu calls read the counters", report[i].name, (unsigned long long)report[i].countedCalls);
+    }
+    if (da::profileReportString().find("IPC") != std::string::npos && !available)
+        WARNF("counter columns without counters");
+}
+
+void test_sampling()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // a period of a whole second, 0 is clamped to that
+    for (int hz = 0; hz <= 1; hz++)
+    {
+        if (!da::startSampling(hz, 1))
+            WARNF("failed to start sampling at %d Hz", hz);
+        da::stopSampling();
+    }
+
+    if (!da::startSampling(1000, 1000))
+    {
+        WARNF("failed to start sampling");
+        return;
+    }
+    const clock_t start = clock();
+    while (clock() - start < CLOCKS_PER_SEC / 10)
+        profiledWork(10);
+    da::stopSampling();
+
+    const da::SamplingStats stats = da::samplingStats();
+    const std::string folded = da::foldedStacks();
+    if (stats.samples == 0 || folded.empty())
+        WARNF("no samples in 100 ms of CPU time");
+    else if (folded[folded.size() - 1] != '\n' || folded.find(' ') == std::string::npos)
+        WARNF("malformed folded stacks: %s", folded.c_str());
+    else
+        TRACEF("  sampled");
+}
+
+void test_metrics()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.push_back(std::thread([]() {
+            for (int i = 0; i < 1000; i++)
+            {
+                DA_COUNTER("test_requests_total{code=\"200\"}", "Requests.").inc();
+                DA_HISTOGRAM("test_request_seconds", "Latency.", 0.01, 0.1).observe(i % 3 * 0.05);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    DA_GAUGE("test_queue_length", "Queue length.").set(7);
+
+    const std::string text = da::prometheusText();
+    const char * expected[] = {
+        "# TYPE test_requests_total counter\n",
+        "test_requests_total{code=\"200\"} 4000\n",
+        "test_request_seconds_bucket{le=\"0.01\"} 1336\n",
+        "test_request_seconds_bucket{le=\"+Inf\"} 4000\n",
+        "test_request_seconds_count 4000\n",
+        "test_queue_length 7\n",
+    };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        if (text.find(expected[i]) == std::string::npos)
+            WARNF("missing \"%s\" in:\n%s", expected[i], text.c_str());
+    }
+    TRACEF("  %d lines", (int)std::count(text.begin(), text.end(), '\n'));
+}
+
+// the first frame is the same for every call, even if the caller's loop gets unrolled
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+size_t stackTraceFromHere(char * buf, size_t size)
+{
+    const size_t len = da::getStackTrace(buf, size, "  ", 0);
+    buf[size - 1] = '\0';     // something after the call, so it's not a tail call
+    return len;
+}
+
+void test_stackTrace()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // the second round comes from the cache and has to look the same
+    char traces[2][4096];
+    for (int i = 0; i < 2; i++)
+        stackTraceFromHere(traces[i], sizeof(traces[i]));
+    const size_t firstLine = strcspn(traces[0], "\n");
+    if (strncmp(traces[0], "  Frame  1: ", 12) != 0 || strncmp(traces[0], traces[1], firstLine + 1) != 0)
+        WARNF("unexpected traces:\n%s---\n%s", traces[0], traces[1]);
+
+    char small[20];
+    const size_t len = da::getStackTrace(small, sizeof(small), "", 0);
+    if (len != sizeof(small) - 1 || strlen(small) != len)
+        WARNF("truncated trace: %d \"%s\"", (int)len, small);
+
+    if (da::getStackTrace("  ", 0).find("  Frame  1: ") != 0)
+        WARNF("unexpected trace:\n%s", da::getStackTrace("  ", 0).c_str());
+}
+
+da::StackTrace captureFromHere()
+{
+    return da::StackTrace::capture();
+}
+
+void test_stackTraceInterning()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    int printed = 0;
+    uint32_t id = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        const da::StackTrace trace = captureFromHere();
+        const std::string s = trace.toLogString("  ");
+        printed += s.find("Frame  1: ") != std::string::npos;
+        if (i == 0)
+            id = trace.intern();
+        else if (trace.intern() != id)
+            WARNF("stack %d got id %u instead of %u", i, trace.intern(), id);
+    }
+    if (printed != 1 || id == 0)
+        WARNF("printed %d times, id %u", printed, id);
+
+    const da::StackTrace here = da::StackTrace::capture();
+    if (here.intern() == id || here == captureFromHere())
+        WARNF("different stacks are equal");
+
+    char buf[4096];
+    here.format(buf, sizeof(buf), "  ");
+    if (here.toString("  ") != buf || here.size() == 0)
+        WARNF("format() and toString() differ:\n%s---\n%s", buf, here.toString("  ").c_str());
+}
+
+// one call site for both unwinders, not inlined nor a tail call
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+int captureWithUnwinder(da::EStackUnwinder::E unwinder, void ** frames)
+{
+    da::setStackUnwinder(unwinder);
+    const int count = da::captureStack(frames, 64);
+    da::setStackUnwinder(da::EStackUnwinder::backtrace);
+    return count;
+}
+
+void test_stackUnwinder()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // further up than captureWithUnwinder() the frame pointers depend on the
+    // build's flags, without them backtrace() takes over
+    void * frames[2][64];
+    int counts[2];
+    counts[0] = captureWithUnwinder(da::EStackUnwinder::backtrace, frames[0]);
+    counts[1] = captureWithUnwinder(da::EStackUnwinder::framePointers, frames[1]);
+    if (counts[0] < 2 || counts[1] < 2 || frames[0][0] != frames[1][0])
+        WARNF("unwinders differ: %d frames, %d frames", counts[0], counts[1]);
+
+    da::setStackUnwinder(da::EStackUnwinder::framePointers);
+    da::setStackTraceDepth(2);
+    const std::string trace = da::getStackTrace("", 0);
+    if (trace.find("Frame  1: ") != 0 || trace.find("Frame  2: ") != std::string::npos)
+        WARNF("unexpected trace with depth 2:\n%s", trace.c_str());
+    da::setStackTraceDepth(32);
+
+    // frame pointers skip a caller without its own frame record, like this function may be
+    da::setStackUnwinder(da::EStackUnwinder::backtrace);
+    const da::StackTrace captured = da::StackTrace::capture();
+    if (captured.size() == 0 || captured.toString().find(__func__) == std::string::npos)
+        WARNF("unexpected trace:\n%s", captured.toString().c_str());
+}
+
+// internal linkage: not in .dynsym even with "-rdynamic", only .symtab names it
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static std::string stackTraceFromStaticFunction()
+{
+    const std::string trace = da::getStackTrace("", 0);
+    return trace + "";      // not a tail call
+}
+
+void test_symbolizer()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    da::SymbolInfo info;
+    if (!da::symbolize((const void *)&test_symbolizer, &info, false))
+    {
+        WARNF("test_symbolizer() not found");
+        return;
+    }
+    const std::string function = da::detail::demangleSymbol(info.function);
+    const std::string file = info.file.substr(info.file.rfind('/') + 1);
+    TRACEF("  %s+0x%zx at %s", function.c_str(), info.offset, file.c_str());
+    if (function != "test_symbolizer()" || info.offset != 0 || file != "main.cpp" || info.line <= 0)
+        WARNF("unexpected symbol: %s %s+0x%zx at %s:%d", info.object.c_str(), info.function.c_str(), info.offset, info.file.c_str(), info.line);
+
+    const std::string trace = stackTraceFromStaticFunction();
+    if (trace.find(" stackTraceFromStaticFunction() ") == std::string::npos || trace.find("main.cpp:") == std::string::npos)
+        WARNF("unexpected trace:\n%s", trace.c_str());
+
+    // the vdso has no file to read, only the object is known
+    const ElfW(Ehdr) * vdso = (const ElfW(Ehdr) *)getauxval(AT_SYSINFO_EHDR);
+    if (vdso && da::symbolize((const char *)vdso + vdso->e_entry, &info, false) && !info.file.empty())
+        WARNF("vdso line: %s:%d", info.file.c_str(), info.line);
+}
+
+std::string * allocateForProfiler(std::vector<std::string> & words)
+{
+    words = da::split<std::vector<std::string> >("alpha,bravo,charlie,delta", ",");
+    return new std::string(da::join(words, " "));
+}
+
+void test_allocProfiler()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    // every byte sampled, so every allocation
+    da::startAllocationProfiling(1);
+    std::vector<std::string> words;
+    std::string * kept = allocateForProfiler(words);
+    words = std::vector<std::string>();
+    da::stopAllocationProfiling();
+
+    const std::string report = da::allocationReportString(100);
+    if (report.find("allocateForProfiler") == std::string::npos)
+        WARNF("no allocateForProfiler() in:\n%s", report.c_str());
+    if (da::allocationReportString(100, true).find("allocateForProfiler") == std::string::npos)
+        WARNF("allocateForProfiler() not live:\n%s", da::allocationReportString(100, true).c_str());
+
+    delete kept;
+    const std::string live = da::allocationReportString(100, true);
+    if (live.find("allocateForProfiler") != std::string::npos)
+        WARNF("allocateForProfiler() still live:\n%s", live.c_str());
+    TRACEF("  %s", report.substr(0, report.find(" in ")).c_str());
+}
+
+int * volatile g_crashPointer = 0;
+
+void test_crashHandler()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        WARNF("pipe() failed");
+        return;
+    }
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        struct rlimit noCore = { 0, 0 };
+        setrlimit(RLIMIT_CORE, &noCore);
+        close(fds[0]);
+        da::installCrashHandler(fds[1]);
+        *g_crashPointer = 1;
+        _exit(0);
+    }
+    close(fds[1]);
+    std::string report;
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(fds[0], buf, sizeof(buf))) > 0)
+        report.append(buf, len);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV)
+        WARNF("the child didn't die of SIGSEGV, status %d", status);
+    if (report.find("*** SIGSEGV (11), fault address 0x0, thread ") != 0 || std::count(report.begin(), report.end(), '\n') < 2)
+        WARNF("unexpected report:\n%s", report.c_str());
+    else
+        TRACEF("  %s", report.substr(0, report.find(',')).c_str());
+}
+
+void test_tracer()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    const char path[] = "danadam_test.trace.json";
+    da::startTracing(8);
+    std::thread other(profiledWork, 3);
+    profiledWork(20);       // more than fits, only the last ones are kept
+    other.join();
+    da::stopTracing();
+    profiledWork(1);        // not traced
+    if (!da::writeTrace(path))
+    {
+        WARNF("failed to write %s", path);
+        return;
+    }
+
+    FILE * in = fopen(path, "r");
+    int events = 0;
+    char line[256];
+    while (in && fgets(line, sizeof(line), in))
+        events += strstr(line, "\"ph\":\"X\"") != 0;
+    if (in)
+        fclose(in);
+    // all 8 slots of this thread (nothing writes any more), the other thread's 3 inner scopes and its outer one
+    if (events != 8 + 4)
+        WARNF("%d events, expected 12", events);
+    TRACEF("  %d events in %s", events, path);
+    remove(path);
+}
+
+void test_bench()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    da::bench::Options options;
+    options.warmupNs = 1000 * 1000;
+    options.sampleNs = 100 * 1000;
+    options.samples = 5;
+    da::bench::Suite suite(options);
+    int64_t n = 0;
+    const da::bench::Result & r = suite.run("itoa", [&]() {
+        char buf[32];
+        da::bench::doNotOptimize(da::itoa(n++, buf, sizeof(buf)));
+    });
+    TRACEF("  %s: %d samples", r.name.c_str(), r.samples);
+    if (!(r.medianNs > 0 && r.minNs <= r.medianNs && r.medianNs <= r.maxNs && r.iterations > 0))
+        WARNF("implausible result: median %g min %g max %g", r.medianNs, r.minNs, r.maxNs);
+    if (suite.toJson().find("\"name\":\"itoa\"") == std::string::npos)
+        WARNF("itoa missing in the JSON");
+
+    // every thread makes the same number of calls per sample
+    std::atomic<uint64_t> calls(0);
+    const da::bench::Result & threaded = suite.runThreaded("2 threads", 2, [&]() { calls++; });
+    if (calls % 2 != 0 || calls < 2 * threaded.iterations * threaded.samples)
+        WARNF("%llu calls for %llu iterations", (unsigned long long)calls.load(), (unsigned long long)threaded.iterations);
+}
+
+void test_latencyHistogram()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    da::LatencyHistogram histogram;
+    da::LatencyHistogram other;
+    for (uint64_t i = 1; i <= 1000; i++)
+        (i % 2 ? histogram : other).record(i * 1000);
+    histogram.merge(other);
+    TRACEF("  %s", histogram.toString().c_str());
+
+    const double percentiles[] = { 50, 99, 99.9 };
+    for (int i = 0; i < 3; i++)
+    {
+        const double exact = percentiles[i] * 10 * 1000;
+        const double error = (histogram.percentile(percentiles[i]) - exact) / exact;
+        if (error < 0 || error > 0.01)
+            WARNF("p%g is off by %g", percentiles[i], error);
+    }
+    if (histogram.count() != 1000 || histogram.min() != 1000 || histogram.max() != 1000000)
+        WARNF("wrong count, min or max");
+}
+
+void test_loggerb()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    int i = 42;
+    char str[] = "meaning of life";
+
+    LOGB(da::ELogLevel::trace, "Binary message without open log: %s - %d", str, i);
+
+    const char path[] = "danadam_test.dalog";
+    if (!da::openBinaryLog(path))
+    {
+        WARNF("failed to open %s", path);
+        return;
+    }
+    LOGB(da::ELogLevel::trace, "Binary message: %s - %d", str, i);
+    LOGB(da::ELogLevel::info, "Binary message with conversions: %5.2f|%-4d|%x|%c|%%", 3.14159, -7, 255u, 'z');
+    da::closeBinaryLog();
+
+    TRACEF("  * Decoded:");
+    FILE * in = fopen(path, "rb");
+    if (!in || !da::decodeBinaryLog(in))
+        WARNF("failed to decode %s", path);
+    if (in)
+        fclose(in);
+    remove(path);
+}
+
+void test_hexEncode()
+{
+    TRACE("%1(): --------------------------------").arg(__func__);
+
+    uint8_t data[300];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 37 + 11);
+
+    // every length and alignment against the scalar kernel, also checking no byte past the end is written
+    char simd[2 * sizeof(data) + 1];
+    char scalar[2 * sizeof(data) + 1];
+    int mismatches = 0;
+    for (size_t offset = 0; offset < 4; offset++)
+    {
+        for (size_t len = 0; len + offset <= sizeof(data); len++)
+        {
+            simd[2 * len] = 'Z';
+            const char * end = da::hexEncode(simd, data + offset, len);
+            da::detail::hexEncodeScalar(scalar, data + offset, len);
+            if (end != simd + 2 * len || simd[2 * len] != 'Z' || memcmp(simd, scalar, 2 * len) != 0)
+                mismatches++;
+        }
+    }
+    if (mismatches)
+        WARNF("%s differs from scalar %d times", da::hexEncoderName(), mismatches);
+
+    const uint8_t line[] = { 0x00, 0xab, 0xff };
+    char * hex = da::hexdumpLineRaw(line, sizeof(line));
+    if (strcmp(hex, "00 ab ff") != 0)
+        WARNF("hexdumpLineRaw(): \"%s\"", hex);
+    delete[] hex;
+    TRACEF("  encoder: %s", da::hexEncoderName());
+}
+
 void test_itoa()
 {
     TRACE("%1(): --------------------------------").arg(__func__);
@@ -561,8 +1404,37 @@ int main(int argc, char * argv[])
     (void)argc;
     (void)argv;
 
+    // at startup, not in the first TSC timer (test_bench())
+    if (ElapsedTimer::calibrateTsc() != ElapsedTimer::isTscUsable())
+        WARNF("calibrateTsc() and isTscUsable() disagree");
+
     test_loggerf();
     test_loggerqt();
+    test_loggerf_async();
+    test_loggerf_asyncFlush();
+    test_loggerf_asyncRestart();
+    test_loggerf_asyncThreadExit();
+    test_loggerf_asyncFormat();
+    test_loggerf_batching();
+    test_loggerf_limit();
+    test_loggerf_file();
+    test_loggerf_rules();
+    test_loggerf_config();
+    test_profiler();
+    test_tracer();
+    test_perfCounters();
+    test_sampling();
+    test_metrics();
+    test_stackTrace();
+    test_stackTraceInterning();
+    test_stackUnwinder();
+    test_symbolizer();
+    test_allocProfiler();
+    test_crashHandler();
+    test_latencyHistogram();
+    test_bench();
+    test_loggerb();
+    test_hexEncode();
     test_itoa();
     test_escapeString();
     test_emailValidator();
@@ -0,0 +1,19 @@
+QT -= gui core
+CONFIG -= debug release debug_and_release qt
+CONFIG += release
+CONFIG += console
+QMAKE_CXXFLAGS_WARN_ON = -Wall -Wextra
+QMAKE_CXXFLAGS += -std=c++0x
+LIBS += -lpthread
+TEMPLATE = app
+TARGET = da-logdecode
+DEPENDPATH += . ../../danadam
+INCLUDEPATH += . ../../danadam
+
+# Input
+HEADERS += ../../danadam/loggercommon.h \
+           ../../danadam/loggeroutput.h \
+           ../../danadam/loggerargs.h \
+           ../../danadam/loggerbin.h \
+
+SOURCES += main.cpp
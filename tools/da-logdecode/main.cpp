@@ -0,0 +1,45 @@
+#include "loggerbin.h"
+
+#include <stdio.h>
+#include <string.h>
+
+INIT_LOGGER();
+
+/*
+ * Turns a binary log written with DA_LOGF_BINARY / da::openBinaryLog() back
+ * into the text format.
+ *
+ * usage: da-logdecode [<file>]     (reads stdin if no file is given)
+ */
+int main(int argc, char * argv[])
+{
+    if (argc > 2 || (argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)))
+    {
+        fprintf(stderr, "usage: %s [<file>]\n", argv[0]);
+        return 2;
+    }
+
+    FILE * in = stdin;
+    if (argc == 2 && strcmp(argv[1], "-") != 0)
+    {
+        in = fopen(argv[1], "rb");
+        if (!in)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    da::setLogBatching(64 * 1024);
+    const bool ok = da::decodeBinaryLog(in);
+    da::flushLogs();
+    if (in != stdin)
+        fclose(in);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s: not a binary log or truncated input\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}